@@ -0,0 +1,55 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public real mode boot emulator macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <mbr.h>
+#include <vbr.h>
+
+#define EMULATOR_MEMORY_SIZE (0x110000)
+#define EMULATOR_BOOT_ADDRESS (0x7C00)
+#define EMULATOR_BOOT_DRIVE (0x80)
+#define EMULATOR_INSTRUCTION_LIMIT (100000000ULL)
+#define EMULATOR_HEADS (255)
+#define EMULATOR_SECTORS_PER_TRACK (63)
+#define EMULATOR_CONSOLE_SIZE (4096)
+
+#define EMULATOR_FLAG_CF (1 << 0)
+#define EMULATOR_FLAG_PF (1 << 2)
+#define EMULATOR_FLAG_AF (1 << 4)
+#define EMULATOR_FLAG_ZF (1 << 6)
+#define EMULATOR_FLAG_SF (1 << 7)
+#define EMULATOR_FLAG_TF (1 << 8)
+#define EMULATOR_FLAG_IF (1 << 9)
+#define EMULATOR_FLAG_DF (1 << 10)
+#define EMULATOR_FLAG_OF (1 << 11)
+#define EMULATOR_FLAG_RESERVED (1 << 1)
+
+typedef enum _EMULATOR_STAGE
+{
+    EmulatorStageMbr,
+    EmulatorStageVbr,
+    EmulatorStageLoader,
+    EmulatorStageCount,
+} EMULATOR_STAGE;
+
+typedef struct _EMULATOR_REPORT
+{
+    uint64_t Instructions;
+    uint64_t StageInstructions[EmulatorStageCount];
+    uint64_t DiskReadCalls;
+    uint64_t SectorsRead;
+    uint64_t DiskWriteCalls;
+    bool Handoff;
+    uint16_t HandoffSegment;
+    uint16_t HandoffOffset;
+    int64_t HandoffLBA;
+    const char *StopReason;
+} EMULATOR_REPORT;
+
+bool EmulatorRun(char *Image, EMULATOR_REPORT *Report);
+bool EmulatorBoot(char *Image);
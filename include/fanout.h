@@ -0,0 +1,50 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public image fan-out macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <pthread.h>
+
+#define FANOUT_CHUNK_SIZE (1024 * 1024 * 8)
+#define FANOUT_CHUNK_ALIGNMENT (4096)
+#define FANOUT_RING_DEPTH (16)
+
+typedef struct _FANOUT_PIPELINE FANOUT_PIPELINE;
+
+/* Runs on the writer of each drive once its image is durable, while the drive is still leased */
+typedef bool (*FANOUT_ROUTINE)(size_t Index, void *Context);
+
+typedef struct _FANOUT_TARGET
+{
+    FANOUT_PIPELINE *Pipeline;
+    char *Device;
+    size_t Index;
+    size_t Written;
+    bool Started;
+    bool Failed;
+} FANOUT_TARGET;
+
+struct _FANOUT_PIPELINE
+{
+    int Source;
+    uint64_t Size;
+    size_t Chunks;
+    uint8_t *Buffers[FANOUT_RING_DEPTH];
+    FANOUT_TARGET *Targets;
+    size_t Count;
+    size_t Opening;
+    FANOUT_ROUTINE Routine;
+    void *Context;
+    size_t Read;
+    bool ReadFailed;
+    pthread_mutex_t Lock;
+    pthread_cond_t Changed;
+};
+
+extern char *FanoutFile;
+
+bool FanoutImage(char *Image, char **Devices, bool *Results, size_t Count, FANOUT_ROUTINE Routine, void *Context);
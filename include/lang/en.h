@@ -21,3 +21,83 @@
 #define STR_000013 "Command example for flashing: %s -MBR /dev/[Drive] myMbr.bin -VBR /dev/[Drive][Partition] myVBR.bin FAT [Partition Number]\n"
 #define STR_000014 "Command example for exporting: %s -EXPORT -MBR /dev/[Drive] myMbr.bin -VBR /dev/[Drive][Partition] myVBR.bin FAT 0\n"
 #define STR_000015 "Incompatible VBR\n"
+#define STR_000016 "Invalid target filter: %s\n"
+#define STR_000017 "%s: %s\n"
+#define STR_000018 "OK"
+#define STR_000019 "FAILED"
+#define STR_000020 "%s size=%llu tran=%s vendor=%s model=%s serial=%s removable=%d\n"
+#define STR_000021 "No target matched the filter\n"
+#define STR_000022 "Command example for targets: %s -TARGETS \"TRAN=usb,MINSIZE=8G,REMOVABLE=1\" -MBR TARGET myMbr.bin -VBR TARGET myVBR.bin FAT [Partition Number]\n"
+#define STR_000023 "Invalid durability mode: %s\n"
+#define STR_000024 "Cannot make the flashed data durable\n"
+#define STR_000025 "Cannot write the transaction to %s\n"
+#define STR_000026 "Command example for emulating: %s disk.img\n"
+#define STR_000027 "Boot failure interrupt"
+#define STR_000028 "Protected mode entry"
+#define STR_000029 "Unsupported instruction"
+#define STR_000030 "Halted"
+#define STR_000031 "Divide error"
+#define STR_000032 "Loader handoff"
+#define STR_000033 "Instruction limit reached"
+#define STR_000034 "Console output:\n%s\n"
+#define STR_000035 "Instructions: %llu (MBR: %llu, VBR: %llu)\nDisk read calls: %llu\nSectors read: %llu\nDisk write calls: %llu\nStop reason: %s at %04X:%04X (LBA %lld)\n"
+#define STR_000036 "Not enough data in the standard input\n"
+#define STR_000037 "The standard output cannot be shared between targets\n"
+#define STR_000038 "Invalid stage 2 location: %s\n"
+#define STR_000039 "The boot code has no stage 2 descriptor\n"
+#define STR_000040 "Not enough free sectors for the stage 2 (%u needed, %llu free)\n"
+#define STR_000041 "The stage 2 area is not free, refusing to overwrite it\n"
+#define STR_000042 "The stage 2 File is too BIG\n"
+#define STR_000043 "The stage 2 can only be installed in the reserved sectors of FAT32\n"
+#define STR_000044 "The backup boot sector at %llu lies outside the partition, leaving it untouched\n"
+#define STR_000045 "%s is mounted, only its boot code bytes are written\n"
+#define STR_000046 "The online mode writes through the partition node, it cannot be combined with a transaction\n"
+#define STR_000047 "Plan written to %s with %llu target(s)\n"
+#define STR_000048 "%s is not a valid plan\n"
+#define STR_000049 "%s does not match the planned target, its size changed\n"
+#define STR_000050 "%s changed since it was planned, refusing to apply\n"
+#define STR_000051 "Command example for planning: %s -PLAN myPlan.bin -MBR /dev/[Drive] myMbr.bin -VBR /dev/[Drive][Partition] myVBR.bin FAT [Partition Number]\n"
+#define STR_000052 "A plan can only be made when flashing\n"
+#define STR_000053 "%s start=%llu end=%llu sectors=%llu\n"
+#define STR_000054 "No boot sector or superblock was found\n"
+#define STR_000055 "Command example for recovery: %s -SCAN /dev/[Drive]\n"
+#define STR_000056 "Invalid lease mode: %s (expected WAIT, FAIL or NONE)\n"
+#define STR_000057 "%s is busy, another instance holds its lease\n"
+#define STR_000058 "%s is busy, waiting for another instance to release its lease\n"
+#define STR_000059 "Partition %u is empty, there is nothing to relocate\n"
+#define STR_000060 "The sectors %llu to %llu are not free on the disk\n"
+#define STR_000061 "Error copying the partition data on %s\n"
+#define STR_000062 "No known file system at the new location, only the partition table is updated\n"
+#define STR_000063 "Partition %u relocated to partition %u at sectors %llu to %llu\n"
+#define STR_000064 "Command example for relocation: %s -RELOCATE /dev/[Drive] [Partition Number] [New Start Sector]\n"
+#define STR_000065 "Verification failed on %s, the drive does not read back what was written\n"
+#define STR_000066 "[%s] %s: %s\n"
+#define STR_000067 "FLASHING"
+#define STR_000068 "Cannot subscribe to the kernel block device events\n"
+#define STR_000069 "Waiting for new drives, press Ctrl+C to stop\n"
+#define STR_000070 "The watch mode needs a -TARGETS filter to select the drives it flashes\n"
+#define STR_000071 "%s is smaller than the image, %llu bytes are needed\n"
+#define STR_000072 "Error writing the image to %s\n"
+#define STR_000073 "An image can only be written when flashing, to the -MBR drive or to the -TARGETS selection\n"
+#define STR_000074 "Command example for imaging: %s -IMAGE base.img -TARGETS \"TRAN=usb\" -MBR TARGET myMbr.bin -VBR TARGET myVBR.bin FAT [Partition Number]\n"
+#define STR_000075 "Invalid sweep rule: %s (expected FAT, FAT16, FAT32, EXT, NTFS or BTRFS=File)\n"
+#define STR_000076 "Partition %u: %s, flashing %s\n"
+#define STR_000077 "Partition %u: no rule for its file system, skipped\n"
+#define STR_000078 "No partition matched a sweep rule\n"
+#define STR_000079 "The sweep mode flashes every partition of the -MBR drive, it cannot be combined with -VBR, -EXPORT or a reserved stage 2\n"
+#define STR_000080 "Command example for sweeping: %s -MBR /dev/[Drive] myMbr.bin -SWEEP \"FAT32=myFat32VBR.bin,NTFS=myNtfsVBR.bin,EXT=myExtVBR.bin\"\n"
+#define STR_000081 "Invalid %s value: %s (expected a size in bytes with an optional K, M, G or T suffix)\n"
+#define STR_000082 "Partition %u of %s is mounted, its boot sector cannot be rewritten through the disk, use -ONLINE without -TRANSACTION\n"
+#define STR_000083 "The kernel could not reread the partition table of %s, it keeps using the old one until it is reread\n"
+#define STR_000084 "Partition %u of %s is mounted, unmount it before moving or cloning it\n"
+#define STR_000085 "Partition %u is empty, there is no VBR to flash\n"
+#define STR_000086 "%s is not partition %u of %s, a transaction reaches the VBR through the disk\n"
+#define STR_000087 "%s or one of its partitions is in use, refusing to overwrite it with an image\n"
+#define STR_000088 "Cannot make the data flashed to %s durable\n"
+#define STR_000089 "-SYNC GROUP cannot be used with -WATCH, there is no end of the run to hold the barrier on\n"
+#define STR_000090 "Cannot receive the kernel block device events\n"
+#define STR_000091 "Some kernel block device events were lost, rescanning the drives\n"
+#define STR_000092 "Stopping, waiting for the drives still being flashed\n"
+#define STR_000093 "%s is not the planned drive, serial %s was planned but %s was found\n"
+#define STR_000094 "The lease directory %s cannot be used, %s is leased through its disk node, instances using the directory are not excluded\n"
+#define STR_000095 "Invalid %s value: %s (expected 0 or 1)\n"
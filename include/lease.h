@@ -0,0 +1,44 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public device lease macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+
+#define LEASE_MODE_WAIT_STRING "WAIT"
+#define LEASE_MODE_FAIL_STRING "FAIL"
+#define LEASE_MODE_NONE_STRING "NONE"
+#define LEASE_DIRECTORY "/run/lock/bootsector-installer"
+#define LEASE_DEVICE_NODE_PATH "/dev/block"
+#define LEASE_KEY_SIZE (64)
+#define LEASE_MAX_KEYS (16)
+
+typedef enum _LEASE_MODE
+{
+    LeaseModeWait,
+    LeaseModeFail,
+    LeaseModeNone,
+} LEASE_MODE;
+
+typedef struct _LEASE_KEY
+{
+    char Name[LEASE_KEY_SIZE];
+    char *Device;
+    dev_t Disk;
+    bool Block;
+} LEASE_KEY;
+
+typedef struct _LEASE
+{
+    int Descriptors[LEASE_MAX_KEYS];
+    size_t Count;
+} LEASE;
+
+extern LEASE_MODE LeaseMode;
+
+bool LeaseParseMode(char *String);
+bool LeaseAcquire(char **Devices, size_t Count, LEASE *Lease);
+void LeaseRelease(LEASE *Lease);
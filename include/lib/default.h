@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -22,6 +23,9 @@
 #include <linux/fs.h>
 
 #define SECTOR_SIZE 512
+#define SYSFS_DEV_BLOCK_PATH "/sys/dev/block"
+#define BLOCK_STACK_MAX_DEPTH (8)
+#define STREAM_FILE_STRING "-"
 
 #define _STR(x) _VAL(x)
 #define _VAL(x) #x
@@ -32,9 +36,51 @@
 #define VBRDEV_ARGUMENT_STRING "-VBR"
 #define VBRDEV_ARGUMENT_STRING_MINARGS 5
 #define EXPORT_ARGUMENT_STRING "-EXPORT"
+#define TARGETS_ARGUMENT_STRING "-TARGETS"
+#define TARGETS_ARGUMENT_STRING_MINARGS 2
+#define TARGET_DEVICE_STRING "TARGET"
+#define SYNC_ARGUMENT_STRING "-SYNC"
+#define SYNC_ARGUMENT_STRING_MINARGS 2
+#define TRANSACTION_ARGUMENT_STRING "-TRANSACTION"
+#define STAGE2_ARGUMENT_STRING "-STAGE2"
+#define STAGE2_ARGUMENT_STRING_MINARGS 3
+#define ONLINE_ARGUMENT_STRING "-ONLINE"
+#define PLAN_ARGUMENT_STRING "-PLAN"
+#define PLAN_ARGUMENT_STRING_MINARGS 2
+#define APPLY_ARGUMENT_STRING "-APPLY"
+#define APPLY_ARGUMENT_STRING_MINARGS 2
+#define SCAN_ARGUMENT_STRING "-SCAN"
+#define SCAN_ARGUMENT_STRING_MINARGS 2
+#define LEASE_ARGUMENT_STRING "-LEASE"
+#define LEASE_ARGUMENT_STRING_MINARGS 2
+#define RELOCATE_ARGUMENT_STRING "-RELOCATE"
+#define RELOCATE_ARGUMENT_STRING_MINARGS 4
+#define CLONE_ARGUMENT_STRING "-CLONE"
+#define CLONE_ARGUMENT_STRING_MINARGS 5
+#define WATCH_ARGUMENT_STRING "-WATCH"
+#define VERIFY_ARGUMENT_STRING "-VERIFY"
+#define IMAGE_ARGUMENT_STRING "-IMAGE"
+#define IMAGE_ARGUMENT_STRING_MINARGS 2
+#define SWEEP_ARGUMENT_STRING "-SWEEP"
+#define SWEEP_ARGUMENT_STRING_MINARGS 2
 
 #include <lang/en.h>
 
 extern bool InvertedFlashDirection;
 
+typedef enum _STREAM_SECTION
+{
+    StreamSectionMbr,
+    StreamSectionVbr,
+} STREAM_SECTION;
+
 int64_t GetFileSize(char *path);
+size_t GetBlockDisks(dev_t Device, dev_t *Disks, size_t MaxDisks);
+bool RereadPartitionTable(int Descriptor);
+
+bool IsStreamFile(char *File);
+bool StreamLoad(size_t MbrSize, size_t VbrSize);
+size_t StreamRead(STREAM_SECTION Section, void *Buffer, size_t Size);
+void StreamRedirectMessages(void);
+FILE *OpenFile(char *File, const char *Mode);
+void CloseFile(FILE *File);
@@ -0,0 +1,16 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public threading helpers declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <pthread.h>
+
+#define PARALLEL_MAX_THREADS (64)
+
+typedef void (*PARALLEL_ROUTINE)(size_t Index, void *Context);
+
+void ParallelFor(size_t Count, size_t MaxThreads, PARALLEL_ROUTINE Routine, void *Context);
@@ -11,6 +11,9 @@
 #define MBR_SIGNATURE_LOW (0x55)
 #define MBR_SIGNATURE_HIGH (0xAA)
 #define MBR_SIZE (sizeof(MBR))
+#define MBR_CHS_HEADS (255)
+#define MBR_CHS_SECTORS (63)
+#define MBR_CHS_CYLINDERS (1024)
 
 #pragma pack(push, 1)
 
@@ -35,4 +38,7 @@ typedef struct _MBR
 
 #pragma pack(pop)
 
+void *MbrReadFile(char *File);
+bool MbrInstall(MBR *Dest, MBR *Src);
+void MbrLbaToChs(uint64_t LBA, uint8_t CHS[3]);
 bool MbrFlash(char *Device, char *File, uint8_t PartitionNumber, uint64_t *PartitionStartSector, uint64_t *PartitionEndSector);
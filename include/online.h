@@ -0,0 +1,21 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public online install macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <vbr.h>
+#include <patch.h>
+
+#define ONLINE_MOUNTINFO_FILE "/proc/self/mountinfo"
+
+extern bool OnlineMode;
+
+bool OnlineIsMounted(char *Device);
+bool OnlineIsPartitionMounted(char *Disk, uint64_t StartSector);
+bool OnlineIsDiskMounted(char *Disk);
+bool OnlinePatches(VBR_INSTALLER *VBR_Installer, void *Previous, void *Dest, uint16_t VBRSize,
+                   PATCH_LIST *Backups, PATCH_LIST *Patches);
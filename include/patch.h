@@ -0,0 +1,29 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public patch list macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+
+typedef struct _PATCH
+{
+    uint64_t Offset;
+    uint32_t Size;
+    void *Buffer;
+} PATCH;
+
+typedef struct _PATCH_LIST
+{
+    PATCH *Patches;
+    size_t Count;
+    size_t Capacity;
+} PATCH_LIST;
+
+bool PatchListAdd(PATCH_LIST *List, uint64_t Offset, void *Buffer, uint32_t Size);
+bool PatchListAppend(PATCH_LIST *List, PATCH_LIST *Source, uint64_t Offset);
+bool PatchListWrite(int Descriptor, PATCH_LIST *List);
+bool PatchListVerify(int Descriptor, PATCH_LIST *List);
+void PatchListFree(PATCH_LIST *List);
@@ -0,0 +1,61 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public plan macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <patch.h>
+
+#define PLAN_SIGNATURE "BSIPLAN2"
+#define PLAN_HASH_OFFSET_BASIS (0xCBF29CE484222325ULL)
+#define PLAN_HASH_PRIME (0x100000001B3ULL)
+
+#pragma pack(push, 1)
+
+/*
+ * A plan file is the header, then for every target its header followed by
+ * the device path, the disk serial and its patches, each patch header
+ * followed by its bytes
+ */
+typedef struct _PLAN_HEADER
+{
+    uint8_t Signature[8];
+    uint32_t TargetCount;
+} PLAN_HEADER;
+
+typedef struct _PLAN_TARGET_HEADER
+{
+    uint64_t Size;
+    uint64_t PreImageHash;
+    uint32_t PatchCount;
+    uint16_t DeviceLength;
+    uint16_t SerialLength;
+} PLAN_TARGET_HEADER;
+
+typedef struct _PLAN_PATCH_HEADER
+{
+    uint64_t Offset;
+    uint32_t Size;
+} PLAN_PATCH_HEADER;
+
+#pragma pack(pop)
+
+typedef struct _PLAN_TARGET
+{
+    char *Device;
+    char *Serial;
+    uint64_t Size;
+    uint64_t PreImageHash;
+    PATCH_LIST Patches;
+    void *Data;
+    bool Result;
+} PLAN_TARGET;
+
+extern char *PlanFile;
+
+bool PlanRecord(char *Device, int Descriptor, PATCH_LIST *Patches);
+bool PlanSave(void);
+bool PlanApply(char *File);
@@ -0,0 +1,63 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public partition relocation macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <mbr.h>
+#include <vbr.h>
+#include <patch.h>
+#include <pthread.h>
+
+#define RELOCATE_CHUNK_SIZE (1024 * 1024 * 8)
+#define RELOCATE_CHUNK_ALIGNMENT (4096)
+#define RELOCATE_RING_DEPTH (4)
+
+/* Only the first sector is read back, the fields of the larger VBR layouts are reached through their offset */
+#define RELOCATE_SET_FIELD(Sector, Type, Field, Value)                                                   \
+    do                                                                                                  \
+    {                                                                                                   \
+        __typeof__(((Type *)0)->Field) _Value = (Value);                                                \
+        static_assert(offsetof(Type, Field) + sizeof(_Value) <= SECTOR_SIZE, #Field " is past sector 0"); \
+        memcpy((uint8_t *)(Sector) + offsetof(Type, Field), &_Value, sizeof(_Value));                   \
+    } while (0)
+
+#define RELOCATE_GET_FIELD(Sector, Type, Field, Variable)                                                \
+    do                                                                                                  \
+    {                                                                                                   \
+        __typeof__(((Type *)0)->Field) _Value;                                                          \
+        static_assert(offsetof(Type, Field) + sizeof(_Value) <= SECTOR_SIZE, #Field " is past sector 0"); \
+        memcpy(&_Value, (uint8_t *)(Sector) + offsetof(Type, Field), sizeof(_Value));                   \
+        (Variable) = _Value;                                                                            \
+    } while (0)
+
+typedef struct _RELOCATE_PIPELINE
+{
+    int Descriptor;
+    uint64_t From;
+    uint64_t To;
+    uint64_t Size;
+    bool Backward;
+    size_t Chunks;
+    uint8_t *Buffers[RELOCATE_RING_DEPTH];
+    size_t Read;
+    size_t Written;
+    bool Failed;
+    pthread_mutex_t Lock;
+    pthread_cond_t Changed;
+} RELOCATE_PIPELINE;
+
+/* The location-dependent sectors patched once the data sits at its new start */
+typedef struct _RELOCATION
+{
+    MBR Mbr;
+    uint8_t Primary[SECTOR_SIZE];
+    uint8_t Backup[SECTOR_SIZE];
+    PATCH_LIST Patches;
+} RELOCATION;
+
+bool RelocatePartition(char *Device, uint8_t PartitionNumber, uint64_t NewStartSector,
+                       uint8_t NewPartitionNumber);
@@ -0,0 +1,29 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public recovery scan macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <mbr.h>
+#include <vbr.h>
+
+#define SCAN_CHUNK_SIZE (1024 * 1024 * 8)
+#define SCAN_CHUNK_ALIGNMENT (4096)
+#define SCAN_EXT_SUPERBLOCK_OFFSET (1024)
+#define SCAN_EXT_MAX_LOG_BLOCK_SIZE (6)
+#define SCAN_BTRFS_SUPERBLOCK_OFFSET (0x10000)
+#define SCAN_BTRFS_BYTENR_OFFSET (0x30)
+#define SCAN_BTRFS_TOTAL_BYTES_OFFSET (0x70)
+
+typedef struct _SCAN_CANDIDATE
+{
+    char *FileSystem;
+    uint64_t StartSector;
+    uint64_t EndSector;
+    uint64_t BackupSector;
+} SCAN_CANDIDATE;
+
+bool ScanDevice(char *Device);
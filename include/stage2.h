@@ -0,0 +1,55 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public stage 2 loader macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <mbr.h>
+#include <vbr.h>
+
+#define STAGE2_SIGNATURE "STG2"
+#define STAGE2_SIZE_LIMIT (1024 * 1024 * 4)
+#define STAGE2_LOCATION_MBRGAP_STRING "MBRGAP"
+#define STAGE2_LOCATION_RESERVED_STRING "RESERVED"
+
+/* The FAT32 boot record spans three sectors, and so does its backup */
+#define STAGE2_FAT32_BOOT_RECORD_SECTORS (3)
+
+typedef enum _STAGE2_LOCATION
+{
+    Stage2LocationNone,
+    Stage2LocationMbrGap,
+    Stage2LocationReserved,
+} STAGE2_LOCATION;
+
+#pragma pack(push, 1)
+
+/* Placeholder the boot code reserves, the installer fills in where the stage 2 was written */
+typedef struct _STAGE2_DESCRIPTOR
+{
+    uint8_t Signature[4];
+    uint64_t StartLBA;
+    uint32_t Sectors;
+} STAGE2_DESCRIPTOR;
+
+#pragma pack(pop)
+
+typedef struct _STAGE2
+{
+    void *Buffer;
+    uint32_t Size;
+    uint64_t Offset;
+} STAGE2;
+
+extern char *Stage2File;
+extern STAGE2_LOCATION Stage2Location;
+
+bool Stage2ParseLocation(char *String);
+bool Stage2PlaceMbrGap(int Descriptor, MBR *Previous, MBR *Dest, STAGE2 *Stage2);
+bool Stage2PlaceFatReserved(int Descriptor, uint64_t Offset, uint16_t VBRSize,
+                            void *Previous, void *Dest, STAGE2 *Stage2);
+bool Stage2Install(char *Device, STAGE2_LOCATION Location, uint16_t VBRSize, void *Previous, void *Dest);
+void Stage2Free(STAGE2 *Stage2);
@@ -0,0 +1,25 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public partition sweep macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <vbr.h>
+
+#define SWEEP_FILESYSTEM_FAT16_STRING "FAT16"
+#define SWEEP_FILESYSTEM_FAT32_STRING "FAT32"
+#define SWEEP_MAX_RULES (8)
+
+typedef struct _SWEEP_RULE
+{
+    char *FileSystem;
+    char *File;
+} SWEEP_RULE;
+
+extern bool SweepMode;
+
+bool SweepParseRules(char *String);
+SWEEP_RULE *SweepFindRule(VBR_INSTALLER *VBR_Installer, uint16_t VBRSize);
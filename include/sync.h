@@ -0,0 +1,43 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public durability macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+
+#define SYNC_MODE_NONE_STRING "NONE"
+#define SYNC_MODE_TARGET_STRING "TARGET"
+#define SYNC_MODE_GROUP_STRING "GROUP"
+#define SYNC_DESCRIPTOR_LINK_PATH "/proc/self/fd"
+
+typedef enum _SYNC_MODE
+{
+    SyncModeNone,
+    SyncModeTarget,
+    SyncModeGroup,
+} SYNC_MODE;
+
+typedef struct _SYNC_IDENTITY
+{
+    dev_t Device;
+    ino_t Inode;
+} SYNC_IDENTITY;
+
+typedef struct _SYNC_PENDING
+{
+    int Descriptor;
+    SYNC_IDENTITY Identity;
+} SYNC_PENDING;
+
+extern SYNC_MODE DurabilityMode;
+extern bool DurabilityModeGiven;
+
+bool SyncParseMode(char *String);
+bool SyncHandle(int Descriptor);
+bool SyncHandleForced(int Descriptor);
+bool SyncFile(FILE *File);
+bool SyncBarrier(void);
+bool SyncFailed(char *Device);
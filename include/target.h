@@ -0,0 +1,66 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public target discovery macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+
+#define TARGET_SYSFS_BLOCK_PATH "/sys/block"
+#define TARGET_DEVICE_PATH "/dev"
+#define TARGET_NAME_SIZE (64)
+#define TARGET_PATH_SIZE (TARGET_NAME_SIZE + 16)
+#define TARGET_STRING_SIZE (128)
+#define TARGET_MOUNTINFO_FILE "/proc/self/mountinfo"
+#define TARGET_ROOT_PATH "/"
+#define TARGET_MAX_SYSTEM_DISKS (16)
+
+#define TARGET_FILTER_NAME_STRING "NAME"
+#define TARGET_FILTER_MINSIZE_STRING "MINSIZE"
+#define TARGET_FILTER_MAXSIZE_STRING "MAXSIZE"
+#define TARGET_FILTER_TRANSPORT_STRING "TRAN"
+#define TARGET_FILTER_VENDOR_STRING "VENDOR"
+#define TARGET_FILTER_MODEL_STRING "MODEL"
+#define TARGET_FILTER_SERIAL_STRING "SERIAL"
+#define TARGET_FILTER_REMOVABLE_STRING "REMOVABLE"
+
+typedef struct _TARGET_FILTER
+{
+    char *Name;
+    uint64_t MinSize;
+    uint64_t MaxSize;
+    char *Transport;
+    char *Vendor;
+    char *Model;
+    char *Serial;
+    int8_t Removable;
+} TARGET_FILTER;
+
+typedef struct _TARGET
+{
+    char Name[TARGET_NAME_SIZE];
+    char Device[TARGET_PATH_SIZE];
+    char PartitionDevice[TARGET_PATH_SIZE];
+    uint64_t Size;
+    char Transport[TARGET_STRING_SIZE];
+    char Vendor[TARGET_STRING_SIZE];
+    char Model[TARGET_STRING_SIZE];
+    char Serial[TARGET_STRING_SIZE];
+    bool Removable;
+    bool Excluded;
+    bool Matched;
+    bool Result;
+} TARGET;
+
+typedef bool (*TARGET_ROUTINE)(TARGET *Target);
+
+bool TargetParseFilter(char *String, TARGET_FILTER *Filter);
+bool TargetProbeName(TARGET_FILTER *Filter, uint8_t PartitionNumber, TARGET *Target);
+size_t TargetDiscover(TARGET_FILTER *Filter, uint8_t PartitionNumber, TARGET **Targets);
+bool TargetPartitionDevice(char *Name, uint8_t PartitionNumber, char *Device, size_t DeviceSize);
+bool TargetRunAll(TARGET *Targets, size_t Count, TARGET_ROUTINE Routine);
+bool TargetReport(TARGET *Targets, size_t Count);
+void TargetDeviceSerial(char *Device, char *Serial, size_t SerialSize);
+void TargetPrint(TARGET *Target);
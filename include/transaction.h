@@ -0,0 +1,37 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public single handle MBR&VBR transaction functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <mbr.h>
+#include <vbr.h>
+#include <patch.h>
+#include <stage2.h>
+
+#define TRANSACTION_MAX_VBRS (4)
+
+typedef struct _TRANSACTION
+{
+    MBR Dest;
+    MBR *Src;
+    void *DestVBR[TRANSACTION_MAX_VBRS];
+    void *SrcVBR[TRANSACTION_MAX_VBRS];
+    STAGE2 Stage2;
+    PATCH_LIST Patches;
+    PATCH_LIST Backups;
+} TRANSACTION;
+
+extern bool TransactionMode;
+extern bool TransactionVerify;
+
+bool TransactionCheckDevice(char *Device, char *VbrDevice, uint8_t PartitionNumber);
+bool TransactionCheck(char *Image, char *MBRFile,
+                      char *VBRFile, char *FileSystem,
+                      uint8_t PartitionNumber);
+bool TransactionFlash(char *Device, char *MBRFile,
+                      char *VBRFile, char *FileSystem,
+                      uint8_t PartitionNumber);
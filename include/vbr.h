@@ -8,6 +8,7 @@
 #pragma once
 #include <lib/default.h>
 #include <mbr.h>
+#include <patch.h>
 
 #define VBR_SIZE_LIMIT (1024 * 8)
 #define VBR_FILESYSTEM_BTRFS_STRING "BTRFS"
@@ -20,6 +21,10 @@
 #define VBR_FILESYSTEM_EXT_SIZE (SECTOR_SIZE * 4)
 #define VBR_FILESYSTEM_NTFS_SIZE (SECTOR_SIZE * 4)
 #define VBR_FILESYSTEM_TYPE_FAT32_STRING "FAT32   "
+#define VBR_FILESYSTEM_TYPE_FAT_STRING "FAT"
+#define VBR_FILESYSTEM_OEM_NTFS_STRING "NTFS    "
+#define VBR_FILESYSTEM_SIGNATURE_BTRFS "_BHRfS_M"
+#define VBR_FILESYSTEM_SIGNATURE_BTRFS_OFFSET (0x10040)
 #define VBR_FILESYSTEM_SIGNATURE_EXT (0xEF53)
 #define EXT_DEFAULT_INODE_SIZE (128)
 #define EXT_DEFAULT_DESC_SIZE (32)
@@ -28,13 +33,21 @@
 #define EXT4_FEATURE_INCOMPAT_EXTENTS (0x0040)
 #define EXT4_FEATURE_INCOMPAT_64BIT (0x0080)
 
+/* Byte range of a VBR that belongs to the boot code and not to the file system */
+typedef struct _VBR_RANGE
+{
+    uint16_t Offset;
+    uint16_t Size;
+} VBR_RANGE;
+
 typedef struct _VBR_INSTALLER
 {
     uint16_t VBRSize;
     char *FileSystem;
     bool (*Install)(uint8_t PartitionNumber,
                     uint64_t *PartitionStartSector, uint64_t *PartitionEndSector,
-                    void *Dest, void *Src);
+                    void *Dest, void *Src, PATCH_LIST *Backups);
+    size_t (*BootCodeRanges)(void *Dest, const VBR_RANGE **Ranges);
 } VBR_INSTALLER;
 
 #pragma pack(push, 1)
@@ -231,6 +244,10 @@ static_assert(sizeof(NTFS_VBR) == VBR_FILESYSTEM_NTFS_SIZE, "The NTFS VBR struct
 
 #pragma pack(pop)
 
+bool IsFat32(void *Buffer);
+VBR_INSTALLER *VbrFindInstaller(char *FileSystem);
+VBR_INSTALLER *VbrDetectFileSystem(int Descriptor, uint64_t Offset, uint16_t *VBRSize);
+void *VbrReadFile(char *File, uint16_t BufferSize, uint16_t FileSize);
 bool VbrFlash(char *Device, char *File, char *FileSystem,
               uint8_t PartitionNumber,
               uint64_t *PartitionStartSector, uint64_t *PartitionEndSector);
@@ -0,0 +1,40 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add public hotplug watch macros, structures and functions declarations
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#pragma once
+#include <lib/default.h>
+#include <target.h>
+
+#define WATCH_BUFFER_SIZE (8192)
+#define WATCH_MAX_WORKERS (16)
+#define WATCH_SLOT_SIZE (64)
+#define WATCH_NODE_TIMEOUT_MS (5000)
+#define WATCH_NODE_POLL_MS (50)
+#define WATCH_KERNEL_GROUP (1)
+#define WATCH_RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+#define WATCH_DISK_SEQUENCE_FILE "diskseq"
+
+typedef struct _WATCH_JOB
+{
+    TARGET Target;
+    TARGET_FILTER *Filter;
+    uint8_t PartitionNumber;
+    TARGET_ROUTINE Routine;
+    char Slot[WATCH_SLOT_SIZE];
+} WATCH_JOB;
+
+/* A disk already seen, the sequence tells a drive plugged again under the same name apart */
+typedef struct _WATCH_DISK
+{
+    char Name[TARGET_NAME_SIZE];
+    uint64_t Sequence;
+    bool Present;
+} WATCH_DISK;
+
+extern bool WatchMode;
+
+bool WatchRun(TARGET_FILTER *Filter, uint8_t PartitionNumber, TARGET_ROUTINE Routine);
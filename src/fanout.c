@@ -0,0 +1,348 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to write a base image to many drives while reading it once
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <fanout.h>
+#include <sync.h>
+#include <lease.h>
+#include <online.h>
+#include <errno.h>
+
+char *FanoutFile = NULL;
+
+static void FanoutChunk(FANOUT_PIPELINE *Pipeline, size_t Index, uint64_t *Offset, size_t *Length)
+{
+    uint64_t Left = Pipeline->Size - (uint64_t)Index * FANOUT_CHUNK_SIZE;
+
+    *Offset = (uint64_t)Index * FANOUT_CHUNK_SIZE;
+    *Length = Left < FANOUT_CHUNK_SIZE ? (size_t)Left : FANOUT_CHUNK_SIZE;
+}
+
+static bool FanoutTransfer(int Descriptor, uint8_t *Buffer, size_t Length, uint64_t Offset, bool Write)
+{
+    size_t Done = 0;
+
+    while (Done < Length)
+    {
+        ssize_t Count = Write ? pwrite(Descriptor, Buffer + Done, Length - Done, (off_t)(Offset + Done))
+                              : pread(Descriptor, Buffer + Done, Length - Done, (off_t)(Offset + Done));
+
+        if (Count <= 0)
+            return false;
+
+        Done += (size_t)Count;
+    }
+
+    return true;
+}
+
+/* The image bypasses the page cache, it would only push out everything else for data never read back */
+static int FanoutOpenTarget(char *Device, uint64_t Size)
+{
+    struct stat Stat;
+
+    /* Never created, a mistyped node would otherwise become a huge file in /dev */
+    if (stat(Device, &Stat) == -1 || (!S_ISBLK(Stat.st_mode) && !S_ISREG(Stat.st_mode)))
+    {
+        printf(DEBUG_STRING STR_000002, Device);
+        return -1;
+    }
+
+    if (OnlineIsDiskMounted(Device))
+    {
+        printf(DEBUG_STRING STR_000087, Device);
+        return -1;
+    }
+
+    int Descriptor = open(Device, O_WRONLY | O_DIRECT);
+
+    if (Descriptor == -1 && errno == EINVAL)
+        Descriptor = open(Device, O_WRONLY);
+
+    if (Descriptor == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Device);
+        return -1;
+    }
+
+    /* An image file ends where the image ends, a disk has to be large enough to take it */
+    if (S_ISREG(Stat.st_mode) ? ftruncate(Descriptor, (off_t)Size) != 0
+                              : (uint64_t)lseek(Descriptor, 0, SEEK_END) < Size)
+    {
+        printf(DEBUG_STRING STR_000071, Device, (unsigned long long)Size);
+        close(Descriptor);
+        return -1;
+    }
+
+    return Descriptor;
+}
+
+static bool FanoutWriteTarget(FANOUT_TARGET *Target, int Descriptor)
+{
+    FANOUT_PIPELINE *Pipeline = Target->Pipeline;
+
+    for (size_t i = 0; i < Pipeline->Chunks; i++)
+    {
+        uint64_t Offset;
+        size_t Length;
+
+        pthread_mutex_lock(&Pipeline->Lock);
+
+        while (!Pipeline->ReadFailed && Pipeline->Read <= i)
+            pthread_cond_wait(&Pipeline->Changed, &Pipeline->Lock);
+
+        bool Ready = Pipeline->Read > i;
+
+        pthread_mutex_unlock(&Pipeline->Lock);
+
+        if (!Ready)
+            return false;
+
+        FanoutChunk(Pipeline, i, &Offset, &Length);
+
+        /* A tail shorter than a block cannot go through direct I/O */
+        if (Length % FANOUT_CHUNK_ALIGNMENT)
+            fcntl(Descriptor, F_SETFL, fcntl(Descriptor, F_GETFL) & ~O_DIRECT);
+
+        if (!FanoutTransfer(Descriptor, Pipeline->Buffers[i % FANOUT_RING_DEPTH], Length, Offset, true))
+            return false;
+
+        pthread_mutex_lock(&Pipeline->Lock);
+        Target->Written++;
+        pthread_cond_broadcast(&Pipeline->Changed);
+        pthread_mutex_unlock(&Pipeline->Lock);
+    }
+
+    return SyncHandle(Descriptor);
+}
+
+static void FanoutLeaveRing(FANOUT_TARGET *Target)
+{
+    FANOUT_PIPELINE *Pipeline = Target->Pipeline;
+
+    /* A failed drive leaves the ring, the others no longer wait for it */
+    pthread_mutex_lock(&Pipeline->Lock);
+    Target->Written = Pipeline->Chunks;
+    pthread_cond_broadcast(&Pipeline->Changed);
+    pthread_mutex_unlock(&Pipeline->Lock);
+}
+
+static void FanoutOpened(FANOUT_PIPELINE *Pipeline)
+{
+    pthread_mutex_lock(&Pipeline->Lock);
+    Pipeline->Opening--;
+    pthread_cond_broadcast(&Pipeline->Changed);
+    pthread_mutex_unlock(&Pipeline->Lock);
+}
+
+static void *FanoutWriter(void *Parameter)
+{
+    FANOUT_TARGET *Target = Parameter;
+    FANOUT_PIPELINE *Pipeline = Target->Pipeline;
+    LEASE Lease;
+    bool Result = false;
+
+    /* Held until the boot sectors are in place too, no other instance can get in between */
+    bool Leased = LeaseAcquire(&Target->Device, 1, &Lease);
+    int Descriptor = Leased ? FanoutOpenTarget(Target->Device, Pipeline->Size) : -1;
+
+    /* A drive that cannot be leased or opened never holds a buffer of the ring */
+    if (Descriptor == -1)
+        FanoutLeaveRing(Target);
+
+    FanoutOpened(Pipeline);
+
+    if (Descriptor != -1)
+    {
+        Result = FanoutWriteTarget(Target, Descriptor);
+
+        if (!Result)
+            printf(DEBUG_STRING STR_000072, Target->Device);
+    }
+
+    FanoutLeaveRing(Target);
+
+    if (Descriptor != -1)
+    {
+        /* The image brings its own partition table, the kernel has to drop the old one */
+        if (Result && !RereadPartitionTable(Descriptor))
+            printf(DEBUG_STRING STR_000083, Target->Device);
+
+        close(Descriptor);
+    }
+
+    if (Result && Pipeline->Routine)
+        Result = Pipeline->Routine(Target->Index, Pipeline->Context);
+
+    if (Leased)
+        LeaseRelease(&Lease);
+
+    Target->Failed = !Result;
+    return NULL;
+}
+
+/* The slowest drive still writing holds the oldest buffer of the ring */
+static size_t FanoutSlowest(FANOUT_PIPELINE *Pipeline)
+{
+    size_t Slowest = Pipeline->Chunks;
+
+    for (size_t i = 0; i < Pipeline->Count; i++)
+    {
+        if (Pipeline->Targets[i].Written < Slowest)
+            Slowest = Pipeline->Targets[i].Written;
+    }
+
+    return Slowest;
+}
+
+static void FanoutReader(FANOUT_PIPELINE *Pipeline)
+{
+    /* Every lease is settled first, a writer still queued behind another instance would stall the ring */
+    pthread_mutex_lock(&Pipeline->Lock);
+
+    while (Pipeline->Opening)
+        pthread_cond_wait(&Pipeline->Changed, &Pipeline->Lock);
+
+    pthread_mutex_unlock(&Pipeline->Lock);
+
+    for (size_t i = 0; i < Pipeline->Chunks; i++)
+    {
+        uint64_t Offset;
+        size_t Length;
+
+        pthread_mutex_lock(&Pipeline->Lock);
+
+        while (i - FanoutSlowest(Pipeline) >= FANOUT_RING_DEPTH && FanoutSlowest(Pipeline) < Pipeline->Chunks)
+            pthread_cond_wait(&Pipeline->Changed, &Pipeline->Lock);
+
+        bool Done = FanoutSlowest(Pipeline) == Pipeline->Chunks;
+
+        pthread_mutex_unlock(&Pipeline->Lock);
+
+        /* Every drive failed, nobody is left to read for */
+        if (Done)
+            break;
+
+        FanoutChunk(Pipeline, i, &Offset, &Length);
+
+        bool Result = FanoutTransfer(Pipeline->Source, Pipeline->Buffers[i % FANOUT_RING_DEPTH], Length, Offset, false);
+
+        pthread_mutex_lock(&Pipeline->Lock);
+
+        if (Result)
+            Pipeline->Read++;
+        else
+            Pipeline->ReadFailed = true;
+
+        pthread_cond_broadcast(&Pipeline->Changed);
+        pthread_mutex_unlock(&Pipeline->Lock);
+
+        if (!Result)
+        {
+            printf(DEBUG_STRING STR_000007);
+            break;
+        }
+    }
+}
+
+/*
+ * The image is read once into a ring of buffers shared by one writer per
+ * drive. Each drive writes at its own pace, and the reader only waits when
+ * the slowest drive still writing falls a whole ring behind
+ */
+bool FanoutImage(char *Image, char **Devices, bool *Results, size_t Count, FANOUT_ROUTINE Routine, void *Context)
+{
+    FANOUT_PIPELINE Pipeline = {
+        .Routine = Routine,
+        .Context = Context,
+    };
+    pthread_t *Threads = calloc(Count, sizeof(pthread_t));
+    bool Result = true;
+
+    Pipeline.Targets = calloc(Count, sizeof(FANOUT_TARGET));
+    Pipeline.Count = Count;
+
+    memset(Results, 0, Count * sizeof(bool));
+
+    if (!Threads || !Pipeline.Targets)
+    {
+        printf(DEBUG_STRING STR_000004);
+        free(Threads);
+        free(Pipeline.Targets);
+        return false;
+    }
+
+    int64_t Size = GetFileSize(Image);
+
+    Pipeline.Source = Size > 0 ? open(Image, O_RDONLY) : -1;
+
+    if (Pipeline.Source == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Image);
+        free(Threads);
+        free(Pipeline.Targets);
+        return false;
+    }
+
+    Pipeline.Size = (uint64_t)Size;
+    Pipeline.Chunks = (size_t)((Pipeline.Size + FANOUT_CHUNK_SIZE - 1) / FANOUT_CHUNK_SIZE);
+    posix_fadvise(Pipeline.Source, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (size_t i = 0; i < FANOUT_RING_DEPTH; i++)
+    {
+        if (posix_memalign((void **)&Pipeline.Buffers[i], FANOUT_CHUNK_ALIGNMENT, FANOUT_CHUNK_SIZE))
+        {
+            printf(DEBUG_STRING STR_000004);
+            Result = false;
+            goto Exit;
+        }
+    }
+
+    pthread_mutex_init(&Pipeline.Lock, NULL);
+    pthread_cond_init(&Pipeline.Changed, NULL);
+    Pipeline.Opening = Count;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        FANOUT_TARGET *Target = &Pipeline.Targets[i];
+
+        Target->Pipeline = &Pipeline;
+        Target->Device = Devices[i];
+        Target->Index = i;
+
+        Target->Started = !pthread_create(&Threads[i], NULL, FanoutWriter, Target);
+
+        if (!Target->Started)
+        {
+            Target->Failed = true;
+            FanoutLeaveRing(Target);
+            FanoutOpened(&Pipeline);
+        }
+    }
+
+    FanoutReader(&Pipeline);
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        if (Pipeline.Targets[i].Started)
+            pthread_join(Threads[i], NULL);
+
+        Results[i] = !Pipeline.Targets[i].Failed;
+        Result &= Results[i];
+    }
+
+    pthread_cond_destroy(&Pipeline.Changed);
+    pthread_mutex_destroy(&Pipeline.Lock);
+
+Exit:
+    for (size_t i = 0; i < FANOUT_RING_DEPTH; i++)
+        free(Pipeline.Buffers[i]);
+
+    close(Pipeline.Source);
+    free(Threads);
+    free(Pipeline.Targets);
+    return Result;
+}
@@ -0,0 +1,243 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to lease devices across installer instances
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <lease.h>
+#include <sys/sysmacros.h>
+#include <errno.h>
+
+LEASE_MODE LeaseMode = LeaseModeWait;
+
+bool LeaseParseMode(char *String)
+{
+    if (!strcasecmp(String, LEASE_MODE_WAIT_STRING))
+        LeaseMode = LeaseModeWait;
+    else if (!strcasecmp(String, LEASE_MODE_FAIL_STRING))
+        LeaseMode = LeaseModeFail;
+    else if (!strcasecmp(String, LEASE_MODE_NONE_STRING))
+        LeaseMode = LeaseModeNone;
+    else
+    {
+        printf(DEBUG_STRING STR_000056, String);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * A partition and every device stacked on top of a disk share the lease of
+ * that disk, the same walk the mount checks use, so all instances agree on
+ * the keys. An image is keyed by its inode
+ */
+static size_t LeaseKeys(char *Device, LEASE_KEY *Keys, size_t MaxKeys)
+{
+    struct stat statbuf;
+    dev_t Disks[LEASE_MAX_KEYS];
+
+    if (!MaxKeys || stat(Device, &statbuf) == -1)
+        return 0;
+
+    if (!S_ISBLK(statbuf.st_mode))
+    {
+        snprintf(Keys[0].Name, sizeof(Keys[0].Name), "i%llx-%llu",
+                 (unsigned long long)statbuf.st_dev, (unsigned long long)statbuf.st_ino);
+        Keys[0].Device = Device;
+        Keys[0].Block = false;
+        return 1;
+    }
+
+    size_t Count = GetBlockDisks(statbuf.st_rdev, Disks, MaxKeys < LEASE_MAX_KEYS ? MaxKeys : LEASE_MAX_KEYS);
+
+    if (!Count)
+    {
+        Disks[0] = statbuf.st_rdev;
+        Count = 1;
+    }
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        snprintf(Keys[i].Name, sizeof(Keys[i].Name), "b%u-%u", major(Disks[i]), minor(Disks[i]));
+        Keys[i].Device = Device;
+        Keys[i].Disk = Disks[i];
+        Keys[i].Block = true;
+    }
+
+    return Count;
+}
+
+/* Somebody who can only read the target only takes a shared lease, it still waits for the writers */
+static int LeaseOpenTarget(char *Path, short *Type)
+{
+    int Descriptor = open(Path, O_RDWR | O_CLOEXEC);
+
+    *Type = F_WRLCK;
+
+    if (Descriptor == -1 && (errno == EACCES || errno == EROFS || errno == EPERM))
+    {
+        Descriptor = open(Path, O_RDONLY | O_CLOEXEC);
+        *Type = F_RDLCK;
+    }
+
+    return Descriptor;
+}
+
+/*
+ * Drives meet in a shared directory, their nodes come and go with the
+ * hardware. It lives in a world writable parent, so neither the directory
+ * nor a lock file is followed through a link, and a directory somebody
+ * else owns or can write to is never trusted
+ */
+static int LeaseOpenDirectory(char *Key, short *Type)
+{
+    struct stat statbuf;
+    char Path[PATH_MAX];
+
+    if (mkdir(LEASE_DIRECTORY, 0755) == -1 && errno != EEXIST)
+        return -1;
+
+    int Directory = open(LEASE_DIRECTORY, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+    if (Directory == -1 || fstat(Directory, &statbuf) == -1 ||
+        (statbuf.st_uid != geteuid() && statbuf.st_uid != 0) || (statbuf.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+        if (Directory != -1)
+            close(Directory);
+
+        return -1;
+    }
+
+    snprintf(Path, sizeof(Path), "%s.lock", Key);
+
+    int Descriptor = openat(Directory, Path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+
+    close(Directory);
+    *Type = F_WRLCK;
+    return Descriptor;
+}
+
+static int LeaseOpen(LEASE_KEY *Key, short *Type)
+{
+    char Node[PATH_MAX];
+
+    /* An image is locked through its own descriptor, it needs nothing shared with other users */
+    if (!Key->Block)
+        return LeaseOpenTarget(Key->Device, Type);
+
+    int Descriptor = LeaseOpenDirectory(Key->Name, Type);
+
+    if (Descriptor != -1)
+        return Descriptor;
+
+    /* Whoever can open the whole disk node can still lock it directly */
+    snprintf(Node, sizeof(Node), LEASE_DEVICE_NODE_PATH "/%u:%u", major(Key->Disk), minor(Key->Disk));
+
+    printf(DEBUG_STRING STR_000094, LEASE_DIRECTORY, Key->Device);
+
+    Descriptor = LeaseOpenTarget(Node, Type);
+
+    /* Without udev there is no canonical node, the device given is the best left */
+    if (Descriptor == -1 && errno == ENOENT)
+        Descriptor = LeaseOpenTarget(Key->Device, Type);
+
+    if (Descriptor == -1)
+        printf(DEBUG_STRING STR_000002, Key->Device);
+
+    return Descriptor;
+}
+
+/* Open file description locks belong to the descriptor, so -TARGETS workers exclude each other too */
+static bool LeaseLock(int Descriptor, char *Device, short Type)
+{
+    struct flock Lock = {
+        .l_type = Type,
+        .l_whence = SEEK_SET,
+    };
+
+    if (!fcntl(Descriptor, F_OFD_SETLK, &Lock))
+        return true;
+
+    if (errno != EAGAIN && errno != EACCES)
+        return false;
+
+    if (LeaseMode == LeaseModeFail)
+    {
+        printf(DEBUG_STRING STR_000057, Device);
+        return false;
+    }
+
+    printf(DEBUG_STRING STR_000058, Device);
+
+    while (fcntl(Descriptor, F_OFD_SETLKW, &Lock))
+    {
+        if (errno != EINTR)
+            return false;
+    }
+
+    return true;
+}
+
+bool LeaseAcquire(char **Devices, size_t Count, LEASE *Lease)
+{
+    LEASE_KEY Keys[LEASE_MAX_KEYS];
+    size_t KeyCount = 0;
+
+    Lease->Count = 0;
+
+    if (LeaseMode == LeaseModeNone)
+        return true;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        /* Devices that do not exist yet fail on their own when they are opened */
+        if (Devices[i] && !IsStreamFile(Devices[i]))
+            KeyCount += LeaseKeys(Devices[i], &Keys[KeyCount], LEASE_MAX_KEYS - KeyCount);
+    }
+
+    /* Always taken in the same order, two instances leasing the same devices cannot deadlock */
+    for (size_t i = 1; i < KeyCount; i++)
+    {
+        for (size_t j = i; j && strcmp(Keys[j - 1].Name, Keys[j].Name) > 0; j--)
+        {
+            LEASE_KEY Key = Keys[j];
+
+            Keys[j] = Keys[j - 1];
+            Keys[j - 1] = Key;
+        }
+    }
+
+    for (size_t i = 0; i < KeyCount; i++)
+    {
+        short Type;
+
+        if (i && !strcmp(Keys[i - 1].Name, Keys[i].Name))
+            continue;
+
+        int Descriptor = LeaseOpen(&Keys[i], &Type);
+
+        if (Descriptor == -1 || !LeaseLock(Descriptor, Keys[i].Device, Type))
+        {
+            if (Descriptor != -1)
+                close(Descriptor);
+
+            LeaseRelease(Lease);
+            return false;
+        }
+
+        Lease->Descriptors[Lease->Count++] = Descriptor;
+    }
+
+    return true;
+}
+
+void LeaseRelease(LEASE *Lease)
+{
+    /* Closing the description drops its lock */
+    for (size_t i = 0; i < Lease->Count; i++)
+        close(Lease->Descriptors[i]);
+
+    Lease->Count = 0;
+}
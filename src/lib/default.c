@@ -6,6 +6,14 @@
  */
 
 #include <lib/default.h>
+#include <sys/sysmacros.h>
+#include <dirent.h>
+#include <errno.h>
+
+/* Payloads streamed through stdin are read once, then shared by every reader */
+static uint8_t *StreamBuffer = NULL;
+static size_t StreamSectionOffset[2], StreamSectionSize[2];
+static FILE *StreamOutput = NULL;
 
 int64_t GetFileSize(char *path)
 {
@@ -49,4 +57,185 @@ int64_t GetFileSize(char *path)
     }
 
     return -1;
-}
\ No newline at end of file
+}
+
+static void GetBlockDisksFrom(char *SysPath, dev_t *Disks, size_t MaxDisks, size_t *Count, int Depth)
+{
+    char Path[PATH_MAX], Buffer[32];
+    unsigned int Major, Minor;
+    bool Stacked = false;
+
+    if (Depth > BLOCK_STACK_MAX_DEPTH)
+        return;
+
+    /* Device mapper and md devices sit on top of the devices listed in their slaves */
+    if (snprintf(Path, sizeof(Path), "%s/slaves", SysPath) < (int)sizeof(Path))
+    {
+        DIR *Directory = opendir(Path);
+
+        if (Directory)
+        {
+            struct dirent *Entry;
+
+            while ((Entry = readdir(Directory)))
+            {
+                if (Entry->d_name[0] == '.' ||
+                    snprintf(Path, sizeof(Path), "%s/slaves/%s", SysPath, Entry->d_name) >= (int)sizeof(Path))
+                    continue;
+
+                Stacked = true;
+                GetBlockDisksFrom(Path, Disks, MaxDisks, Count, Depth + 1);
+            }
+
+            closedir(Directory);
+        }
+    }
+
+    if (Stacked)
+        return;
+
+    /* A partition belongs to the disk one directory above it */
+    snprintf(Path, sizeof(Path), "%s/partition", SysPath);
+    snprintf(Path, sizeof(Path), access(Path, F_OK) ? "%s/dev" : "%s/../dev", SysPath);
+
+    FILE *File = fopen(Path, "r");
+    if (!File)
+        return;
+
+    bool Parsed = fgets(Buffer, sizeof(Buffer), File) && sscanf(Buffer, "%u:%u", &Major, &Minor) == 2;
+
+    fclose(File);
+
+    if (!Parsed)
+        return;
+
+    for (size_t i = 0; i < *Count; i++)
+    {
+        if (Disks[i] == makedev(Major, Minor))
+            return;
+    }
+
+    if (*Count < MaxDisks)
+        Disks[(*Count)++] = makedev(Major, Minor);
+}
+
+size_t GetBlockDisks(dev_t Device, dev_t *Disks, size_t MaxDisks)
+{
+    char Path[PATH_MAX];
+    size_t Count = 0;
+
+    snprintf(Path, sizeof(Path), SYSFS_DEV_BLOCK_PATH "/%u:%u", major(Device), minor(Device));
+    GetBlockDisksFrom(Path, Disks, MaxDisks, &Count, 0);
+
+    return Count;
+}
+
+/* Images and disks the kernel does not partition have nothing to reread */
+bool RereadPartitionTable(int Descriptor)
+{
+    struct stat statbuf;
+
+    if (fstat(Descriptor, &statbuf) == -1 || !S_ISBLK(statbuf.st_mode))
+        return true;
+
+    if (!ioctl(Descriptor, BLKRRPART))
+        return true;
+
+    return errno == EINVAL || errno == ENOTTY;
+}
+
+bool IsStreamFile(char *File)
+{
+    return File && !strcmp(File, STREAM_FILE_STRING);
+}
+
+bool StreamLoad(size_t MbrSize, size_t VbrSize)
+{
+    size_t Size = MbrSize + VbrSize;
+
+    if (!Size)
+        return true;
+
+    StreamBuffer = calloc(1, Size);
+    if (!StreamBuffer)
+    {
+        printf(DEBUG_STRING STR_000004);
+        return false;
+    }
+
+    StreamSectionOffset[StreamSectionMbr] = 0;
+    StreamSectionSize[StreamSectionMbr] = MbrSize;
+    StreamSectionOffset[StreamSectionVbr] = MbrSize;
+
+    /* The MBR payload must be complete, the VBR payload may be shorter than its file system descriptor */
+    size_t Count = fread(StreamBuffer, 1, Size, stdin);
+
+    if (Count < MbrSize)
+    {
+        printf(DEBUG_STRING STR_000036);
+        return false;
+    }
+
+    StreamSectionSize[StreamSectionVbr] = Count - MbrSize;
+
+    return true;
+}
+
+size_t StreamRead(STREAM_SECTION Section, void *Buffer, size_t Size)
+{
+    if (!StreamBuffer)
+        return 0;
+
+    if (Size > StreamSectionSize[Section])
+        Size = StreamSectionSize[Section];
+
+    memcpy(Buffer, StreamBuffer + StreamSectionOffset[Section], Size);
+
+    return Size;
+}
+
+void StreamRedirectMessages(void)
+{
+    int Descriptor = dup(STDOUT_FILENO);
+
+    if (Descriptor == -1)
+        return;
+
+    StreamOutput = fdopen(Descriptor, "wb");
+    if (!StreamOutput)
+    {
+        close(Descriptor);
+        return;
+    }
+
+    /* Keep the data stream clean, every message goes to stderr from now on */
+    fflush(stdout);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+}
+
+FILE *OpenFile(char *File, const char *Mode)
+{
+    if (IsStreamFile(File))
+    {
+        if (*Mode == 'r')
+            return stdin;
+
+        return StreamOutput ? StreamOutput : stdout;
+    }
+
+    return fopen(File, Mode);
+}
+
+void CloseFile(FILE *File)
+{
+    if (File == stdin)
+        return;
+
+    if (File == stdout || File == StreamOutput)
+    {
+        fflush(File);
+        return;
+    }
+
+    fclose(File);
+}
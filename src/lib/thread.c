@@ -0,0 +1,72 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Add threading helpers functions for default library
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <lib/thread.h>
+
+typedef struct _PARALLEL_STATE
+{
+    size_t Count;
+    size_t Next;
+    PARALLEL_ROUTINE Routine;
+    void *Context;
+} PARALLEL_STATE;
+
+static void *ParallelWorker(void *Parameter)
+{
+    PARALLEL_STATE *State = Parameter;
+
+    for (;;)
+    {
+        size_t Index = __atomic_fetch_add(&State->Next, 1, __ATOMIC_RELAXED);
+
+        if (Index >= State->Count)
+            break;
+
+        State->Routine(Index, State->Context);
+    }
+
+    return NULL;
+}
+
+void ParallelFor(size_t Count, size_t MaxThreads, PARALLEL_ROUTINE Routine, void *Context)
+{
+    PARALLEL_STATE State = {
+        .Count = Count,
+        .Next = 0,
+        .Routine = Routine,
+        .Context = Context,
+    };
+
+    if (!MaxThreads || MaxThreads > PARALLEL_MAX_THREADS)
+        MaxThreads = PARALLEL_MAX_THREADS;
+
+    if (MaxThreads > Count)
+        MaxThreads = Count;
+
+    /* Nothing to gain from a thread for a single item */
+    if (MaxThreads <= 1)
+    {
+        ParallelWorker(&State);
+        return;
+    }
+
+    pthread_t Threads[PARALLEL_MAX_THREADS];
+    size_t Started = 0;
+
+    for (; Started < MaxThreads; Started++)
+    {
+        if (pthread_create(&Threads[Started], NULL, ParallelWorker, &State))
+            break;
+    }
+
+    /* Whatever could not be spawned is drained by the calling thread */
+    if (!Started)
+        ParallelWorker(&State);
+
+    for (size_t i = 0; i < Started; i++)
+        pthread_join(Threads[i], NULL);
+}
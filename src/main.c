@@ -8,6 +8,18 @@
 #include <lib/default.h>
 #include <mbr.h>
 #include <vbr.h>
+#include <target.h>
+#include <sync.h>
+#include <transaction.h>
+#include <stage2.h>
+#include <online.h>
+#include <plan.h>
+#include <scan.h>
+#include <lease.h>
+#include <relocate.h>
+#include <watch.h>
+#include <fanout.h>
+#include <sweep.h>
 
 bool InvertedFlashDirection;
 
@@ -18,8 +30,204 @@ char *VBRDevice = NULL;
 char *VBRFile = NULL;
 char *VBRFileSystem = NULL;
 uint8_t VBRPartitionNumber = 0;
-uint64_t VBRPartitionStartSector = 0;
-uint64_t VBRPartitionEndSector = 0;
+
+char *TargetFilterString = NULL;
+char *ApplyFile = NULL;
+char *ScanImage = NULL;
+
+char *RelocateDevice = NULL;
+uint8_t RelocatePartitionNumber = 0;
+uint8_t RelocateNewPartitionNumber = 0;
+uint64_t RelocateStartSector = 0;
+
+char *SelectDevice(char *Device, char *TargetDevice)
+{
+    if (Device && !strcasecmp(Device, TARGET_DEVICE_STRING))
+        return TargetDevice;
+
+    return Device;
+}
+
+/* The caller holds the lease of both devices */
+bool FlashLeasedDevices(char *MbrDevice, char *VbrDevice)
+{
+    uint64_t PartitionStartSector = 0, PartitionEndSector = 0;
+    bool Result = true;
+
+    /* A -VBR TARGET always names the partition of the same drive, anything else is checked */
+    if (TransactionMode && !InvertedFlashDirection)
+    {
+        if (MbrDevice && VbrDevice && strcasecmp(VBRDevice, TARGET_DEVICE_STRING) &&
+            !TransactionCheckDevice(MbrDevice, VbrDevice, VBRPartitionNumber))
+            Result = false;
+        else
+            Result = TransactionFlash(MbrDevice, MBRFile, VbrDevice ? VBRFile : NULL, VBRFileSystem,
+                                      VBRPartitionNumber);
+    }
+    else
+    {
+        if (MbrDevice)
+            Result &= MbrFlash(MbrDevice, MBRFile, VBRPartitionNumber,
+                               &PartitionStartSector, &PartitionEndSector);
+
+        if (VbrDevice)
+            Result &= VbrFlash(VbrDevice, VBRFile, VBRFileSystem,
+                               VBRPartitionNumber, &PartitionStartSector, &PartitionEndSector);
+    }
+
+    return Result;
+}
+
+bool FlashDevices(char *MbrDevice, char *VbrDevice)
+{
+    char *Devices[] = {MbrDevice, VbrDevice};
+    LEASE Lease;
+
+    /* Held for the whole read-modify-write, other instances queue or fail fast */
+    if (!LeaseAcquire(Devices, sizeof(Devices) / sizeof(char *), &Lease))
+        return false;
+
+    bool Result = FlashLeasedDevices(MbrDevice, VbrDevice);
+
+    LeaseRelease(&Lease);
+    return Result;
+}
+
+bool FlashTarget(TARGET *Target)
+{
+    return FlashDevices(SelectDevice(MBRDevice, Target->Device),
+                        SelectDevice(VBRDevice, Target->PartitionDevice));
+}
+
+bool PrepareStreams(void)
+{
+    bool MbrStream = MBRDevice && IsStreamFile(MBRFile);
+    bool VbrStream = VBRDevice && IsStreamFile(VBRFile);
+
+    if (!MbrStream && !VbrStream)
+        return true;
+
+    if (InvertedFlashDirection)
+    {
+        if (TargetFilterString)
+        {
+            printf(DEBUG_STRING STR_000037);
+            return false;
+        }
+
+        StreamRedirectMessages();
+        return true;
+    }
+
+    VBR_INSTALLER *VBR_Installer = VbrStream && VBRFileSystem ? VbrFindInstaller(VBRFileSystem) : NULL;
+
+    /* Both payloads can share stdin, the MBR comes first and the VBR follows it */
+    return StreamLoad(MbrStream ? MBR_SIZE : 0, VBR_Installer ? VBR_Installer->VBRSize : 0);
+}
+
+/* Runs on the fan-out writer, still holding the lease the image was written under */
+bool FlashImagedTarget(size_t Index, void *Context)
+{
+    TARGET *Targets = Context;
+
+    return FlashLeasedDevices(SelectDevice(MBRDevice, Targets[Index].Device),
+                              SelectDevice(VBRDevice, Targets[Index].PartitionDevice));
+}
+
+bool FlashImagedDevice(size_t Index, void *Context)
+{
+    return FlashLeasedDevices(MBRDevice, VBRDevice);
+}
+
+/* Checked against the image itself, its partition table is the one the drives end up with */
+bool CheckImagePayloads(void)
+{
+    if (!MBRDevice && !VBRDevice)
+        return true;
+
+    return TransactionCheck(FanoutFile, MBRDevice ? MBRFile : NULL, VBRDevice ? VBRFile : NULL,
+                            VBRFileSystem, VBRPartitionNumber);
+}
+
+/* The boot sectors only go to the drives that took the whole image */
+bool ImageTargets(TARGET *Targets, size_t Count)
+{
+    char **Devices = calloc(Count, sizeof(char *));
+    bool *Results = calloc(Count, sizeof(bool));
+
+    if (!Devices || !Results)
+    {
+        printf(DEBUG_STRING STR_000004);
+        free(Devices);
+        free(Results);
+        return false;
+    }
+
+    for (size_t i = 0; i < Count; i++)
+        Devices[i] = Targets[i].Device;
+
+    bool Result = FanoutImage(FanoutFile, Devices, Results, Count,
+                              MBRDevice || VBRDevice ? FlashImagedTarget : NULL, Targets);
+
+    for (size_t i = 0; i < Count; i++)
+        Targets[i].Result = Results[i];
+
+    free(Devices);
+    free(Results);
+    return Result;
+}
+
+int FlashTargets(void)
+{
+    TARGET_FILTER Filter;
+    TARGET *Targets;
+
+    if (!TargetParseFilter(TargetFilterString, &Filter))
+        return 1;
+
+    size_t Count = TargetDiscover(&Filter, VBRPartitionNumber + 1, &Targets);
+    if (!Count)
+    {
+        printf(DEBUG_STRING STR_000021);
+        return 1;
+    }
+
+    /* Without anything to flash the selection is only listed */
+    if (!MBRDevice && !VBRDevice && !FanoutFile)
+    {
+        for (size_t i = 0; i < Count; i++)
+            TargetPrint(&Targets[i]);
+
+        free(Targets);
+        return 0;
+    }
+
+    bool Result = FanoutFile ? CheckImagePayloads() && ImageTargets(Targets, Count)
+                             : TargetRunAll(Targets, Count, FlashTarget);
+
+    Result &= SyncBarrier();
+    Result &= TargetReport(Targets, Count);
+    Result &= PlanSave();
+
+    free(Targets);
+    return Result ? 0 : 1;
+}
+
+int WatchTargets(void)
+{
+    TARGET_FILTER Filter;
+
+    if (!TargetFilterString)
+    {
+        printf(DEBUG_STRING STR_000070);
+        return 1;
+    }
+
+    if (!TargetParseFilter(TargetFilterString, &Filter))
+        return 1;
+
+    return WatchRun(&Filter, VBRPartitionNumber + 1, FlashTarget) ? 0 : 1;
+}
 
 int main(int argc, char **argv)
 {
@@ -66,19 +274,240 @@ int main(int argc, char **argv)
         {
             InvertedFlashDirection = true;
         }
+        else if (!strcasecmp(arg[0], TARGETS_ARGUMENT_STRING))
+        {
+            argStep = TARGETS_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            TargetFilterString = arg[1];
+        }
+        else if (!strcasecmp(arg[0], TRANSACTION_ARGUMENT_STRING))
+        {
+            TransactionMode = true;
+        }
+        else if (!strcasecmp(arg[0], PLAN_ARGUMENT_STRING))
+        {
+            argStep = PLAN_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            /* The plan is computed through the single handle path, only the write is left out */
+            PlanFile = arg[1];
+            TransactionMode = true;
+        }
+        else if (!strcasecmp(arg[0], APPLY_ARGUMENT_STRING))
+        {
+            argStep = APPLY_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            ApplyFile = arg[1];
+        }
+        else if (!strcasecmp(arg[0], SCAN_ARGUMENT_STRING))
+        {
+            argStep = SCAN_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            ScanImage = arg[1];
+        }
+        else if (!strcasecmp(arg[0], RELOCATE_ARGUMENT_STRING) || !strcasecmp(arg[0], CLONE_ARGUMENT_STRING))
+        {
+            bool Clone = !strcasecmp(arg[0], CLONE_ARGUMENT_STRING);
+
+            argStep = Clone ? CLONE_ARGUMENT_STRING_MINARGS : RELOCATE_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            RelocateDevice = arg[1];
+            RelocatePartitionNumber = ((uint8_t)atoi(arg[2]) - 1) % 4;
+            RelocateStartSector = strtoull(arg[3], NULL, 0);
+            RelocateNewPartitionNumber = Clone ? ((uint8_t)atoi(arg[4]) - 1) % 4 : RelocatePartitionNumber;
+        }
+        else if (!strcasecmp(arg[0], WATCH_ARGUMENT_STRING))
+        {
+            /* Partitions of a fresh drive may not have their nodes yet, the disk handle is used instead */
+            WatchMode = true;
+            TransactionMode = true;
+        }
+        else if (!strcasecmp(arg[0], VERIFY_ARGUMENT_STRING))
+        {
+            TransactionVerify = true;
+            TransactionMode = true;
+        }
+        else if (!strcasecmp(arg[0], IMAGE_ARGUMENT_STRING))
+        {
+            argStep = IMAGE_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            /* The partition table changes under the kernel, the VBR is reached through the disk handle */
+            FanoutFile = arg[1];
+            TransactionMode = true;
+        }
+        else if (!strcasecmp(arg[0], SWEEP_ARGUMENT_STRING))
+        {
+            argStep = SWEEP_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            /* The partition table is read once and every VBR is written through the disk handle */
+            if (!SweepParseRules(arg[1]))
+                goto error;
+
+            TransactionMode = true;
+        }
+        else if (!strcasecmp(arg[0], LEASE_ARGUMENT_STRING))
+        {
+            argStep = LEASE_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            if (!LeaseParseMode(arg[1]))
+                goto error;
+        }
+        else if (!strcasecmp(arg[0], ONLINE_ARGUMENT_STRING))
+        {
+            OnlineMode = true;
+        }
+        else if (!strcasecmp(arg[0], STAGE2_ARGUMENT_STRING))
+        {
+            argStep = STAGE2_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            Stage2File = arg[1];
+
+            if (!Stage2ParseLocation(arg[2]))
+                goto error;
+        }
+        else if (!strcasecmp(arg[0], SYNC_ARGUMENT_STRING))
+        {
+            argStep = SYNC_ARGUMENT_STRING_MINARGS;
+
+            if (argc - i < argStep)
+            {
+                printf(DEBUG_STRING STR_000000);
+                goto error;
+            }
+
+            if (!SyncParseMode(arg[1]))
+                goto error;
+        }
     }
 
+    if (ScanImage)
+        return ScanDevice(ScanImage) ? 0 : 1;
+
+    if (RelocateDevice)
+        return RelocatePartition(RelocateDevice, RelocatePartitionNumber, RelocateStartSector,
+                                 RelocateNewPartitionNumber) && SyncBarrier() ? 0 : 1;
+
+    if (ApplyFile)
+        return PlanApply(ApplyFile) ? 0 : 1;
+
+    if (PlanFile && InvertedFlashDirection)
+    {
+        printf(DEBUG_STRING STR_000052);
+        goto error;
+    }
+
+    if (FanoutFile && (InvertedFlashDirection || PlanFile || WatchMode || (!TargetFilterString && !MBRDevice)))
+    {
+        printf(DEBUG_STRING STR_000073);
+        goto error;
+    }
+
+    if (SweepMode && (VBRDevice || !MBRDevice || InvertedFlashDirection || Stage2Location == Stage2LocationReserved))
+    {
+        printf(DEBUG_STRING STR_000079);
+        goto error;
+    }
+
+    if (OnlineMode && TransactionMode)
+    {
+        printf(DEBUG_STRING STR_000046);
+        goto error;
+    }
+
+    if (!PrepareStreams())
+        goto error;
+
+    if (WatchMode)
+        return WatchTargets();
+
+    if (TargetFilterString)
+        return FlashTargets();
+
     if (!MBRDevice && !MBRFile && !VBRDevice && !VBRFile)
     {
         printf(STR_000001);
-        printf(STR_000013 STR_000014, *argv, *argv);
+        printf(STR_000013 STR_000014 STR_000022 STR_000051 STR_000055 STR_000064 STR_000074 STR_000080,
+               *argv, *argv, *argv, *argv, *argv, *argv, *argv, *argv);
         goto error;
     }
 
-    MbrFlash(MBRDevice, MBRFile, VBRPartitionNumber, &VBRPartitionStartSector, &VBRPartitionEndSector);
-    VbrFlash(VBRDevice, VBRFile, VBRFileSystem, VBRPartitionNumber, &VBRPartitionStartSector, &VBRPartitionEndSector);
+    if (TransactionMode && !InvertedFlashDirection)
+    {
+        bool Imaged;
+
+        if (FanoutFile)
+        {
+            if (!CheckImagePayloads() || !FanoutImage(FanoutFile, &MBRDevice, &Imaged, 1, FlashImagedDevice, NULL))
+                goto error;
+        }
+        else if (!FlashDevices(MBRDevice, VBRDevice))
+            goto error;
+
+        if (!SyncBarrier() || !PlanSave())
+            goto error;
+
+        return 0;
+    }
+
+    /* Success is only reported once both writes went through and are durable */
+    bool Result = FlashDevices(MBRDevice, VBRDevice);
+
+    Result &= SyncBarrier();
 
-    return 0;
+    return Result ? 0 : 1;
 
 error:
     return 1;
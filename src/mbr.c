@@ -6,6 +6,8 @@
  */
 
 #include <mbr.h>
+#include <sync.h>
+#include <stage2.h>
 
 void *MbrReadFile(char *File)
 {
@@ -15,6 +17,20 @@ void *MbrReadFile(char *File)
         return NULL;
     }
 
+    if (IsStreamFile(File))
+    {
+        void *Buffer = malloc(MBR_SIZE);
+
+        if (!Buffer || StreamRead(StreamSectionMbr, Buffer, MBR_SIZE) != MBR_SIZE)
+        {
+            printf(DEBUG_STRING STR_000004);
+            free(Buffer);
+            return NULL;
+        }
+
+        return Buffer;
+    }
+
     FILE *Bin = fopen(File, "rb");
     if (!Bin)
     {
@@ -69,14 +85,14 @@ bool MbrWriteFile(char *File, void *Buffer)
         return false;
     }
 
-    FILE *Bin = fopen(File, "wb");
+    FILE *Bin = OpenFile(File, "wb");
     if (!Bin)
     {
         printf(DEBUG_STRING STR_000002, File);
         return false;
     }
 
-    int64_t size = GetFileSize(File);
+    int64_t size = IsStreamFile(File) ? MBR_SIZE : GetFileSize(File);
 
     if (!size)
         size = MBR_SIZE;
@@ -84,7 +100,7 @@ bool MbrWriteFile(char *File, void *Buffer)
     if (size < MBR_SIZE)
     {
         printf(DEBUG_STRING STR_000010);
-        fclose(Bin);
+        CloseFile(Bin);
         return false;
     }
 
@@ -93,20 +109,61 @@ bool MbrWriteFile(char *File, void *Buffer)
     if (count < MBR_SIZE)
     {
         printf(DEBUG_STRING STR_000010);
-        fclose(Bin);
+        CloseFile(Bin);
         return false;
     }
 
-    fclose(Bin);
+    if (!SyncFile(Bin))
+    {
+        printf(DEBUG_STRING STR_000024);
+        CloseFile(Bin);
+        return false;
+    }
+
+    CloseFile(Bin);
+
+    return true;
+}
+
+bool MbrInstall(MBR *Dest, MBR *Src)
+{
+    if (Src->MBRSignatureLow != MBR_SIGNATURE_LOW || Src->MBRSignatureHigh != MBR_SIGNATURE_HIGH)
+    {
+        printf(DEBUG_STRING STR_000008);
+        return false;
+    }
+
+    memcpy(Dest->MBRCode, Src->MBRCode, sizeof(Src->MBRCode));
+    Dest->MBRSignatureLow = Src->MBRSignatureLow;
+    Dest->MBRSignatureHigh = Src->MBRSignatureHigh;
 
     return true;
 }
 
+void MbrLbaToChs(uint64_t LBA, uint8_t CHS[3])
+{
+    uint64_t Cylinder = LBA / (MBR_CHS_HEADS * MBR_CHS_SECTORS);
+    uint64_t Head = (LBA / MBR_CHS_SECTORS) % MBR_CHS_HEADS;
+    uint64_t Sector = LBA % MBR_CHS_SECTORS + 1;
+
+    /* Past what CHS can address the entry holds the largest value, the LBA fields are used instead */
+    if (Cylinder >= MBR_CHS_CYLINDERS)
+    {
+        Cylinder = MBR_CHS_CYLINDERS - 1;
+        Head = MBR_CHS_HEADS - 1;
+        Sector = MBR_CHS_SECTORS;
+    }
+
+    CHS[0] = (uint8_t)Head;
+    CHS[1] = (uint8_t)(Sector | ((Cylinder >> 8) << 6));
+    CHS[2] = (uint8_t)Cylinder;
+}
+
 bool MbrFlash(char *Device, char *File,
               uint8_t PartitionNumber,
               uint64_t *PartitionStartSector, uint64_t *PartitionEndSector)
 {
-    MBR *Dest = MbrReadFile(Device), *Src = MbrReadFile(File);
+    MBR *Dest = MbrReadFile(Device), *Src = InvertedFlashDirection || !File ? NULL : MbrReadFile(File);
 
     if (Dest)
     {
@@ -116,6 +173,13 @@ bool MbrFlash(char *Device, char *File,
         *PartitionEndSector = *PartitionStartSector + PTE->PartitionSectors;
     }
 
+    /* A NULL payload only reads the partition bounds for the VBR */
+    if (Dest && !File)
+    {
+        free(Dest);
+        return true;
+    }
+
     if (!Dest || (!Src && !InvertedFlashDirection))
     {
         printf(DEBUG_STRING STR_000007);
@@ -124,19 +188,21 @@ bool MbrFlash(char *Device, char *File,
         return false;
     }
 
-    if (!InvertedFlashDirection)
+    MBR Previous = *Dest;
+
+    if (!InvertedFlashDirection && !MbrInstall(Dest, Src))
     {
-        if (Src->MBRSignatureLow != MBR_SIGNATURE_LOW || Src->MBRSignatureHigh != MBR_SIGNATURE_HIGH)
-        {
-            printf(DEBUG_STRING STR_000008);
-            free(Dest);
-            free(Src);
-            return false;
-        }
+        free(Dest);
+        free(Src);
+        return false;
+    }
 
-        memcpy(Dest->MBRCode, Src->MBRCode, sizeof(Src->MBRCode));
-        Dest->MBRSignatureLow = Src->MBRSignatureLow;
-        Dest->MBRSignatureHigh = Src->MBRSignatureHigh;
+    if (!InvertedFlashDirection && Stage2Location == Stage2LocationMbrGap &&
+        !Stage2Install(Device, Stage2LocationMbrGap, MBR_SIZE, &Previous, Dest))
+    {
+        free(Dest);
+        free(Src);
+        return false;
     }
 
     bool FlashStatus = MbrWriteFile(InvertedFlashDirection ? File : Device, Dest);
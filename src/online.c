@@ -0,0 +1,187 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to refresh the boot code of mounted volumes
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <online.h>
+#include <sys/sysmacros.h>
+#include <dirent.h>
+
+bool OnlineMode;
+
+/* A device is in use when it is mounted, or when a device mapper or md device sits on top of it */
+static bool OnlineIsBusy(unsigned int Major, unsigned int Minor)
+{
+    char Line[4096];
+    bool Result = false;
+
+    snprintf(Line, sizeof(Line), SYSFS_DEV_BLOCK_PATH "/%u:%u/holders", Major, Minor);
+
+    DIR *Holders = opendir(Line);
+    if (Holders)
+    {
+        struct dirent *Entry;
+
+        while (!Result && (Entry = readdir(Holders)))
+            Result = Entry->d_name[0] != '.';
+
+        closedir(Holders);
+    }
+
+    FILE *MountInfo = fopen(ONLINE_MOUNTINFO_FILE, "r");
+    if (!MountInfo)
+        return Result;
+
+    /* The third field of every mount is the major:minor of the device backing it */
+    while (!Result && fgets(Line, sizeof(Line), MountInfo))
+    {
+        unsigned int MountMajor, MountMinor;
+
+        if (sscanf(Line, "%*s %*s %u:%u", &MountMajor, &MountMinor) == 2 &&
+            MountMajor == Major && MountMinor == Minor)
+            Result = true;
+    }
+
+    fclose(MountInfo);
+    return Result;
+}
+
+bool OnlineIsMounted(char *Device)
+{
+    struct stat statbuf;
+
+    if (stat(Device, &statbuf) == -1 || !S_ISBLK(statbuf.st_mode))
+        return false;
+
+    return OnlineIsBusy(major(statbuf.st_rdev), minor(statbuf.st_rdev));
+}
+
+static bool OnlineReadValue(char *Path, unsigned long long *Value)
+{
+    FILE *File = fopen(Path, "r");
+    if (!File)
+        return false;
+
+    bool Result = fscanf(File, "%llu", Value) == 1;
+
+    fclose(File);
+    return Result;
+}
+
+/* Walks the partitions the kernel knows on the disk, any of them or only the one starting at StartSector */
+static bool OnlineIsPartitionBusy(char *Disk, bool AnyPartition, uint64_t StartSector)
+{
+    struct stat statbuf;
+    char Path[PATH_MAX], Buffer[32];
+    bool Result = false;
+
+    if (stat(Disk, &statbuf) == -1 || !S_ISBLK(statbuf.st_mode))
+        return false;
+
+    snprintf(Path, sizeof(Path), SYSFS_DEV_BLOCK_PATH "/%u:%u", major(statbuf.st_rdev), minor(statbuf.st_rdev));
+
+    DIR *Directory = opendir(Path);
+    if (!Directory)
+        return false;
+
+    struct dirent *Entry;
+
+    while (!Result && (Entry = readdir(Directory)))
+    {
+        unsigned int Major, Minor;
+        unsigned long long Start;
+
+        if (Entry->d_name[0] == '.')
+            continue;
+
+        snprintf(Path, sizeof(Path), SYSFS_DEV_BLOCK_PATH "/%u:%u/%.64s/start",
+                 major(statbuf.st_rdev), minor(statbuf.st_rdev), Entry->d_name);
+
+        if (!OnlineReadValue(Path, &Start) || (!AnyPartition && Start != StartSector))
+            continue;
+
+        snprintf(Path, sizeof(Path), SYSFS_DEV_BLOCK_PATH "/%u:%u/%.64s/dev",
+                 major(statbuf.st_rdev), minor(statbuf.st_rdev), Entry->d_name);
+
+        FILE *File = fopen(Path, "r");
+        if (!File)
+            continue;
+
+        if (fgets(Buffer, sizeof(Buffer), File) && sscanf(Buffer, "%u:%u", &Major, &Minor) == 2)
+            Result = OnlineIsBusy(Major, Minor);
+
+        fclose(File);
+    }
+
+    closedir(Directory);
+    return Result;
+}
+
+bool OnlineIsPartitionMounted(char *Disk, uint64_t StartSector)
+{
+    return OnlineIsPartitionBusy(Disk, false, StartSector);
+}
+
+bool OnlineIsDiskMounted(char *Disk)
+{
+    return OnlineIsMounted(Disk) || OnlineIsPartitionBusy(Disk, true, 0);
+}
+
+bool OnlinePatches(VBR_INSTALLER *VBR_Installer, void *Previous, void *Dest, uint16_t VBRSize,
+                   PATCH_LIST *Backups, PATCH_LIST *Patches)
+{
+    const VBR_RANGE *Ranges;
+    size_t Count = VBR_Installer->BootCodeRanges(Dest, &Ranges);
+    uint8_t *Old = Previous, *New = Dest;
+
+    /* Only the bytes that changed are written, the kernel keeps owning everything else */
+    for (size_t i = 0; i < Count; i++)
+    {
+        size_t End = (size_t)Ranges[i].Offset + Ranges[i].Size;
+
+        if (End > VBRSize)
+            End = VBRSize;
+
+        for (size_t j = Ranges[i].Offset; j < End;)
+        {
+            if (Old[j] == New[j])
+            {
+                j++;
+                continue;
+            }
+
+            size_t Start = j;
+
+            while (j < End && Old[j] != New[j])
+                j++;
+
+            if (!PatchListAdd(Patches, Start, &New[Start], (uint32_t)(j - Start)))
+                return false;
+        }
+    }
+
+    /* The backups were never read, their boot code ranges are rewritten whole */
+    for (size_t i = 0; i < Backups->Count; i++)
+    {
+        PATCH *Backup = &Backups->Patches[i];
+
+        for (size_t j = 0; j < Count; j++)
+        {
+            if (Ranges[j].Offset >= Backup->Size)
+                continue;
+
+            uint32_t Size = Ranges[j].Size;
+
+            if (Ranges[j].Offset + Size > Backup->Size)
+                Size = Backup->Size - Ranges[j].Offset;
+
+            if (!PatchListAdd(Patches, Backup->Offset + Ranges[j].Offset,
+                              (uint8_t *)Backup->Buffer + Ranges[j].Offset, Size))
+                return false;
+        }
+    }
+
+    return true;
+}
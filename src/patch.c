@@ -0,0 +1,141 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to batch sector writes at their disk offsets
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <patch.h>
+#include <sys/uio.h>
+
+bool PatchListAdd(PATCH_LIST *List, uint64_t Offset, void *Buffer, uint32_t Size)
+{
+    if (List->Count == List->Capacity)
+    {
+        size_t Capacity = List->Capacity ? List->Capacity * 2 : 8;
+        PATCH *Resized = realloc(List->Patches, Capacity * sizeof(PATCH));
+
+        if (!Resized)
+        {
+            printf(DEBUG_STRING STR_000004);
+            return false;
+        }
+
+        List->Patches = Resized;
+        List->Capacity = Capacity;
+    }
+
+    List->Patches[List->Count++] = (PATCH){
+        .Offset = Offset,
+        .Size = Size,
+        .Buffer = Buffer,
+    };
+
+    return true;
+}
+
+bool PatchListAppend(PATCH_LIST *List, PATCH_LIST *Source, uint64_t Offset)
+{
+    for (size_t i = 0; i < Source->Count; i++)
+    {
+        PATCH *Patch = &Source->Patches[i];
+
+        if (!PatchListAdd(List, Offset + Patch->Offset, Patch->Buffer, Patch->Size))
+            return false;
+    }
+
+    return true;
+}
+
+static bool PatchWriteRun(int Descriptor, struct iovec *Vector, int VectorCount, uint64_t Offset)
+{
+    while (VectorCount)
+    {
+        ssize_t Written = pwritev(Descriptor, Vector, VectorCount, (off_t)Offset);
+
+        if (Written <= 0)
+            return false;
+
+        Offset += (uint64_t)Written;
+
+        /* Skip whatever was completely written and resume inside a partial one */
+        while (VectorCount && (size_t)Written >= Vector->iov_len)
+        {
+            Written -= (ssize_t)Vector->iov_len;
+            Vector++;
+            VectorCount--;
+        }
+
+        if (VectorCount)
+        {
+            Vector->iov_base = (uint8_t *)Vector->iov_base + Written;
+            Vector->iov_len -= (size_t)Written;
+        }
+    }
+
+    return true;
+}
+
+bool PatchListWrite(int Descriptor, PATCH_LIST *List)
+{
+    struct iovec Vector[IOV_MAX];
+
+    /* Patches adjacent on disk are merged into a single vectored write, the list order is kept */
+    for (size_t i = 0; i < List->Count;)
+    {
+        uint64_t Offset = List->Patches[i].Offset, End = Offset;
+        int VectorCount = 0;
+
+        while (i < List->Count && VectorCount < IOV_MAX && List->Patches[i].Offset == End)
+        {
+            Vector[VectorCount].iov_base = List->Patches[i].Buffer;
+            Vector[VectorCount].iov_len = List->Patches[i].Size;
+            End += List->Patches[i].Size;
+            VectorCount++;
+            i++;
+        }
+
+        if (!PatchWriteRun(Descriptor, Vector, VectorCount, Offset))
+            return false;
+    }
+
+    return true;
+}
+
+bool PatchListVerify(int Descriptor, PATCH_LIST *List)
+{
+    /* Dirty pages cannot be dropped, the patches are flushed before they are read back from the drive */
+    if (fdatasync(Descriptor))
+        return false;
+
+    for (size_t i = 0; i < List->Count; i++)
+    {
+        PATCH *Patch = &List->Patches[i];
+        uint8_t *Buffer = malloc(Patch->Size);
+
+        if (!Buffer)
+        {
+            printf(DEBUG_STRING STR_000004);
+            return false;
+        }
+
+        posix_fadvise(Descriptor, (off_t)Patch->Offset, Patch->Size, POSIX_FADV_DONTNEED);
+
+        bool Result = pread(Descriptor, Buffer, Patch->Size, (off_t)Patch->Offset) == (ssize_t)Patch->Size &&
+                      !memcmp(Buffer, Patch->Buffer, Patch->Size);
+
+        free(Buffer);
+
+        if (!Result)
+            return false;
+    }
+
+    return true;
+}
+
+void PatchListFree(PATCH_LIST *List)
+{
+    free(List->Patches);
+    List->Patches = NULL;
+    List->Count = List->Capacity = 0;
+}
@@ -0,0 +1,424 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to plan the patches ahead of time and apply them later
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <plan.h>
+#include <sync.h>
+#include <lib/thread.h>
+#include <lease.h>
+#include <target.h>
+
+char *PlanFile = NULL;
+
+/* Targets recorded while planning, the -TARGETS workers record them concurrently */
+static PLAN_TARGET *PlanTargets = NULL;
+static size_t PlanTargetCount = 0, PlanTargetCapacity = 0;
+static pthread_mutex_t PlanTargetLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t PlanHash(uint64_t Hash, void *Buffer, size_t Size)
+{
+    uint8_t *Bytes = Buffer;
+
+    for (size_t i = 0; i < Size; i++)
+    {
+        Hash ^= Bytes[i];
+        Hash *= PLAN_HASH_PRIME;
+    }
+
+    return Hash;
+}
+
+/* Hash of the bytes the patches are about to replace, past the end of the disk they read as zero */
+static bool PlanPreImageHash(int Descriptor, PATCH_LIST *Patches, uint64_t *Hash)
+{
+    *Hash = PLAN_HASH_OFFSET_BASIS;
+
+    for (size_t i = 0; i < Patches->Count; i++)
+    {
+        PATCH *Patch = &Patches->Patches[i];
+        uint8_t *Buffer = calloc(1, Patch->Size);
+        size_t Done = 0;
+
+        if (!Buffer)
+        {
+            printf(DEBUG_STRING STR_000004);
+            return false;
+        }
+
+        while (Done < Patch->Size)
+        {
+            ssize_t Count = pread(Descriptor, Buffer + Done, Patch->Size - Done, (off_t)(Patch->Offset + Done));
+
+            if (Count < 0)
+            {
+                printf(DEBUG_STRING STR_000007);
+                free(Buffer);
+                return false;
+            }
+
+            if (Count == 0)
+                break;
+
+            Done += (size_t)Count;
+        }
+
+        *Hash = PlanHash(*Hash, Buffer, Patch->Size);
+        free(Buffer);
+    }
+
+    return true;
+}
+
+static void PlanTargetFree(PLAN_TARGET *Target)
+{
+    free(Target->Device);
+    free(Target->Serial);
+    free(Target->Data);
+    PatchListFree(&Target->Patches);
+}
+
+bool PlanRecord(char *Device, int Descriptor, PATCH_LIST *Patches)
+{
+    PLAN_TARGET Target = {0};
+    size_t DataSize = 0, DataOffset = 0;
+    int64_t Size = GetFileSize(Device);
+
+    if (Size == -1)
+    {
+        printf(DEBUG_STRING STR_000004);
+        return false;
+    }
+
+    for (size_t i = 0; i < Patches->Count; i++)
+        DataSize += Patches->Patches[i].Size;
+
+    /* The path alone could name another drive by the time the plan is applied */
+    char Serial[TARGET_STRING_SIZE];
+
+    TargetDeviceSerial(Device, Serial, sizeof(Serial));
+
+    Target.Device = strdup(Device);
+    Target.Serial = strdup(Serial);
+    Target.Size = (uint64_t)Size;
+    Target.Data = malloc(DataSize ? DataSize : 1);
+
+    if (!Target.Device || !Target.Serial || !Target.Data)
+    {
+        printf(DEBUG_STRING STR_000004);
+        PlanTargetFree(&Target);
+        return false;
+    }
+
+    if (!PlanPreImageHash(Descriptor, Patches, &Target.PreImageHash))
+    {
+        PlanTargetFree(&Target);
+        return false;
+    }
+
+    /* The patch buffers belong to the caller, the plan keeps its own copy */
+    for (size_t i = 0; i < Patches->Count; i++)
+    {
+        PATCH *Patch = &Patches->Patches[i];
+        uint8_t *Buffer = (uint8_t *)Target.Data + DataOffset;
+
+        memcpy(Buffer, Patch->Buffer, Patch->Size);
+        DataOffset += Patch->Size;
+
+        if (!PatchListAdd(&Target.Patches, Patch->Offset, Buffer, Patch->Size))
+        {
+            PlanTargetFree(&Target);
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&PlanTargetLock);
+
+    if (PlanTargetCount == PlanTargetCapacity)
+    {
+        size_t Capacity = PlanTargetCapacity ? PlanTargetCapacity * 2 : 8;
+        PLAN_TARGET *Resized = realloc(PlanTargets, Capacity * sizeof(PLAN_TARGET));
+
+        if (!Resized)
+        {
+            pthread_mutex_unlock(&PlanTargetLock);
+            printf(DEBUG_STRING STR_000004);
+            PlanTargetFree(&Target);
+            return false;
+        }
+
+        PlanTargets = Resized;
+        PlanTargetCapacity = Capacity;
+    }
+
+    PlanTargets[PlanTargetCount++] = Target;
+    pthread_mutex_unlock(&PlanTargetLock);
+
+    return true;
+}
+
+static void PlanRelease(void)
+{
+    for (size_t i = 0; i < PlanTargetCount; i++)
+        PlanTargetFree(&PlanTargets[i]);
+
+    free(PlanTargets);
+    PlanTargets = NULL;
+    PlanTargetCount = PlanTargetCapacity = 0;
+}
+
+bool PlanSave(void)
+{
+    PLAN_HEADER Header = {.TargetCount = (uint32_t)PlanTargetCount};
+    bool Result = true;
+
+    if (!PlanFile)
+        return true;
+
+    FILE *Bin = fopen(PlanFile, "wb");
+    if (!Bin)
+    {
+        printf(DEBUG_STRING STR_000002, PlanFile);
+        PlanRelease();
+        return false;
+    }
+
+    memcpy(Header.Signature, PLAN_SIGNATURE, sizeof(Header.Signature));
+    Result &= fwrite(&Header, sizeof(Header), 1, Bin) == 1;
+
+    for (size_t i = 0; i < PlanTargetCount && Result; i++)
+    {
+        PLAN_TARGET *Target = &PlanTargets[i];
+        PLAN_TARGET_HEADER TargetHeader = {
+            .Size = Target->Size,
+            .PreImageHash = Target->PreImageHash,
+            .PatchCount = (uint32_t)Target->Patches.Count,
+            .DeviceLength = (uint16_t)strlen(Target->Device),
+            .SerialLength = (uint16_t)strlen(Target->Serial),
+        };
+
+        Result &= fwrite(&TargetHeader, sizeof(TargetHeader), 1, Bin) == 1;
+        Result &= fwrite(Target->Device, 1, TargetHeader.DeviceLength, Bin) == TargetHeader.DeviceLength;
+        Result &= fwrite(Target->Serial, 1, TargetHeader.SerialLength, Bin) == TargetHeader.SerialLength;
+
+        for (size_t j = 0; j < Target->Patches.Count && Result; j++)
+        {
+            PATCH *Patch = &Target->Patches.Patches[j];
+            PLAN_PATCH_HEADER PatchHeader = {
+                .Offset = Patch->Offset,
+                .Size = Patch->Size,
+            };
+
+            Result &= fwrite(&PatchHeader, sizeof(PatchHeader), 1, Bin) == 1;
+            Result &= fwrite(Patch->Buffer, 1, Patch->Size, Bin) == Patch->Size;
+        }
+    }
+
+    Result &= fclose(Bin) == 0;
+
+    if (Result)
+        printf(DEBUG_STRING STR_000047, PlanFile, (unsigned long long)PlanTargetCount);
+    else
+        printf(DEBUG_STRING STR_000025, PlanFile);
+
+    PlanRelease();
+    return Result;
+}
+
+/* Every length is checked against the bytes left, the plan may come from anywhere */
+static bool PlanTake(uint8_t **Cursor, uint8_t *End, void *Out, size_t Size)
+{
+    if ((size_t)(End - *Cursor) < Size)
+        return false;
+
+    if (Out)
+        memcpy(Out, *Cursor, Size);
+
+    *Cursor += Size;
+    return true;
+}
+
+static bool PlanParse(uint8_t *Buffer, size_t Size)
+{
+    uint8_t *Cursor = Buffer, *End = Buffer + Size;
+    PLAN_HEADER Header;
+
+    if (!PlanTake(&Cursor, End, &Header, sizeof(Header)) ||
+        memcmp(Header.Signature, PLAN_SIGNATURE, sizeof(Header.Signature)))
+        return false;
+
+    PlanTargets = calloc(Header.TargetCount ? Header.TargetCount : 1, sizeof(PLAN_TARGET));
+    if (!PlanTargets)
+        return false;
+
+    PlanTargetCapacity = Header.TargetCount;
+
+    for (uint32_t i = 0; i < Header.TargetCount; i++)
+    {
+        PLAN_TARGET *Target = &PlanTargets[PlanTargetCount++];
+        PLAN_TARGET_HEADER TargetHeader;
+        uint8_t *Device, *Serial;
+
+        if (!PlanTake(&Cursor, End, &TargetHeader, sizeof(TargetHeader)))
+            return false;
+
+        Device = Cursor;
+
+        if (!PlanTake(&Cursor, End, NULL, TargetHeader.DeviceLength))
+            return false;
+
+        Serial = Cursor;
+
+        if (!PlanTake(&Cursor, End, NULL, TargetHeader.SerialLength))
+            return false;
+
+        Target->Device = strndup((char *)Device, TargetHeader.DeviceLength);
+        Target->Serial = strndup((char *)Serial, TargetHeader.SerialLength);
+        Target->Size = TargetHeader.Size;
+        Target->PreImageHash = TargetHeader.PreImageHash;
+
+        if (!Target->Device || !Target->Serial)
+            return false;
+
+        /* The patches point straight into the plan buffer */
+        for (uint32_t j = 0; j < TargetHeader.PatchCount; j++)
+        {
+            PLAN_PATCH_HEADER PatchHeader;
+            uint8_t *Bytes;
+
+            if (!PlanTake(&Cursor, End, &PatchHeader, sizeof(PatchHeader)))
+                return false;
+
+            Bytes = Cursor;
+
+            if (!PlanTake(&Cursor, End, NULL, PatchHeader.Size) ||
+                !PatchListAdd(&Target->Patches, PatchHeader.Offset, Bytes, PatchHeader.Size))
+                return false;
+        }
+    }
+
+    return Cursor == End;
+}
+
+static void PlanApplyTarget(size_t Index, void *Context)
+{
+    PLAN_TARGET *Target = &PlanTargets[Index];
+    uint64_t PreImageHash;
+    LEASE Lease;
+
+    Target->Result = false;
+
+    char Serial[TARGET_STRING_SIZE];
+
+    if (GetFileSize(Target->Device) != (int64_t)Target->Size)
+    {
+        printf(DEBUG_STRING STR_000049, Target->Device);
+        return;
+    }
+
+    /* Device names follow the probe order, the serial is what stays with the drive */
+    TargetDeviceSerial(Target->Device, Serial, sizeof(Serial));
+
+    if (strcmp(Serial, Target->Serial))
+    {
+        printf(DEBUG_STRING STR_000093, Target->Device, Target->Serial[0] ? Target->Serial : "-",
+               Serial[0] ? Serial : "-");
+        return;
+    }
+
+    /* The pre-image check only holds while nobody else can write in between */
+    if (!LeaseAcquire(&Target->Device, 1, &Lease))
+        return;
+
+    int Descriptor = open(Target->Device, O_RDWR);
+    if (Descriptor == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Target->Device);
+        LeaseRelease(&Lease);
+        return;
+    }
+
+    /* Inside the window only a compare and a write are left */
+    if (!PlanPreImageHash(Descriptor, &Target->Patches, &PreImageHash))
+        goto Exit;
+
+    if (PreImageHash != Target->PreImageHash)
+    {
+        printf(DEBUG_STRING STR_000050, Target->Device);
+        goto Exit;
+    }
+
+    if (!PatchListWrite(Descriptor, &Target->Patches))
+    {
+        printf(DEBUG_STRING STR_000025, Target->Device);
+        goto Exit;
+    }
+
+    if (!SyncHandle(Descriptor))
+    {
+        printf(DEBUG_STRING STR_000024);
+        goto Exit;
+    }
+
+    Target->Result = true;
+
+Exit:
+    close(Descriptor);
+    LeaseRelease(&Lease);
+}
+
+bool PlanApply(char *File)
+{
+    bool Result = true;
+    int64_t Size = GetFileSize(File);
+
+    if (Size <= 0)
+    {
+        printf(DEBUG_STRING STR_000002, File);
+        return false;
+    }
+
+    uint8_t *Buffer = malloc((size_t)Size);
+    FILE *Bin = fopen(File, "rb");
+
+    if (!Buffer || !Bin || fread(Buffer, 1, (size_t)Size, Bin) != (size_t)Size)
+    {
+        printf(DEBUG_STRING STR_000004);
+        free(Buffer);
+
+        if (Bin)
+            fclose(Bin);
+
+        return false;
+    }
+
+    fclose(Bin);
+
+    if (!PlanParse(Buffer, (size_t)Size))
+    {
+        printf(DEBUG_STRING STR_000048, File);
+        PlanRelease();
+        free(Buffer);
+        return false;
+    }
+
+    ParallelFor(PlanTargetCount, 0, PlanApplyTarget, NULL);
+
+    /* Every target is told after the barrier, a deferred flush can still fail it */
+    Result &= SyncBarrier();
+
+    for (size_t i = 0; i < PlanTargetCount; i++)
+    {
+        if (SyncFailed(PlanTargets[i].Device))
+            PlanTargets[i].Result = false;
+
+        printf(STR_000017, PlanTargets[i].Device, PlanTargets[i].Result ? STR_000018 : STR_000019);
+        Result &= PlanTargets[i].Result;
+    }
+
+    PlanRelease();
+    free(Buffer);
+    return Result;
+}
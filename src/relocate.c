@@ -0,0 +1,448 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to move or clone a partition and repatch its boot sectors
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <relocate.h>
+#include <sync.h>
+#include <lease.h>
+#include <online.h>
+#include <errno.h>
+#include <linux/blkpg.h>
+
+/* Moving towards the end copies from the last chunk, so no source is overwritten before it is read */
+static void RelocateChunk(RELOCATE_PIPELINE *Pipeline, size_t Index, uint64_t *Offset, size_t *Length)
+{
+    uint64_t Start = (uint64_t)Index * RELOCATE_CHUNK_SIZE;
+    uint64_t Left = Pipeline->Size - Start;
+
+    *Length = Left < RELOCATE_CHUNK_SIZE ? (size_t)Left : RELOCATE_CHUNK_SIZE;
+    *Offset = Pipeline->Backward ? Pipeline->Size - Start - *Length : Start;
+}
+
+static bool RelocateTransfer(int Descriptor, uint8_t *Buffer, size_t Length, uint64_t Offset, bool Write)
+{
+    size_t Done = 0;
+
+    while (Done < Length)
+    {
+        ssize_t Count = Write ? pwrite(Descriptor, Buffer + Done, Length - Done, (off_t)(Offset + Done))
+                              : pread(Descriptor, Buffer + Done, Length - Done, (off_t)(Offset + Done));
+
+        if (Count <= 0)
+            return false;
+
+        Done += (size_t)Count;
+    }
+
+    return true;
+}
+
+/* The kernel copies without a round trip through user space, images on reflink file systems share extents */
+static bool RelocateCopyOffload(RELOCATE_PIPELINE *Pipeline, bool *Supported)
+{
+    *Supported = true;
+
+    for (size_t i = 0; i < Pipeline->Chunks; i++)
+    {
+        uint64_t Offset;
+        size_t Length;
+
+        RelocateChunk(Pipeline, i, &Offset, &Length);
+
+        while (Length)
+        {
+            loff_t From = (loff_t)(Pipeline->From + Offset), To = (loff_t)(Pipeline->To + Offset);
+            ssize_t Count = copy_file_range(Pipeline->Descriptor, &From, Pipeline->Descriptor, &To, Length, 0);
+
+            if (Count <= 0)
+            {
+                /* Block devices and older kernels refuse it, nothing was copied yet */
+                if (!i && Count < 0 && (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP))
+                    *Supported = false;
+
+                return false;
+            }
+
+            Offset += (uint64_t)Count;
+            Length -= (size_t)Count;
+        }
+    }
+
+    return true;
+}
+
+static void *RelocateReader(void *Parameter)
+{
+    RELOCATE_PIPELINE *Pipeline = Parameter;
+
+    for (size_t i = 0; i < Pipeline->Chunks; i++)
+    {
+        uint64_t Offset;
+        size_t Length;
+
+        pthread_mutex_lock(&Pipeline->Lock);
+
+        while (!Pipeline->Failed && i - Pipeline->Written >= RELOCATE_RING_DEPTH)
+            pthread_cond_wait(&Pipeline->Changed, &Pipeline->Lock);
+
+        pthread_mutex_unlock(&Pipeline->Lock);
+
+        if (Pipeline->Failed)
+            break;
+
+        RelocateChunk(Pipeline, i, &Offset, &Length);
+
+        bool Result = RelocateTransfer(Pipeline->Descriptor, Pipeline->Buffers[i % RELOCATE_RING_DEPTH],
+                                       Length, Pipeline->From + Offset, false);
+
+        pthread_mutex_lock(&Pipeline->Lock);
+
+        if (Result)
+            Pipeline->Read++;
+        else
+            Pipeline->Failed = true;
+
+        pthread_cond_broadcast(&Pipeline->Changed);
+        pthread_mutex_unlock(&Pipeline->Lock);
+
+        if (!Result)
+            break;
+    }
+
+    return NULL;
+}
+
+/*
+ * Reads run ahead of the writes through a ring of buffers. A chunk is always
+ * read before it is written and chunks go in copy order, so overlapping
+ * source and destination ranges are safe whatever the distance
+ */
+static bool RelocateCopyPipeline(RELOCATE_PIPELINE *Pipeline)
+{
+    pthread_t Reader;
+    bool Result = true;
+
+    for (size_t i = 0; i < RELOCATE_RING_DEPTH; i++)
+    {
+        if (posix_memalign((void **)&Pipeline->Buffers[i], RELOCATE_CHUNK_ALIGNMENT, RELOCATE_CHUNK_SIZE))
+        {
+            printf(DEBUG_STRING STR_000004);
+
+            for (size_t j = 0; j < i; j++)
+                free(Pipeline->Buffers[j]);
+
+            return false;
+        }
+    }
+
+    pthread_mutex_init(&Pipeline->Lock, NULL);
+    pthread_cond_init(&Pipeline->Changed, NULL);
+
+    if (pthread_create(&Reader, NULL, RelocateReader, Pipeline))
+    {
+        Result = false;
+        goto Exit;
+    }
+
+    for (size_t i = 0; i < Pipeline->Chunks; i++)
+    {
+        uint64_t Offset;
+        size_t Length;
+
+        pthread_mutex_lock(&Pipeline->Lock);
+
+        while (!Pipeline->Failed && Pipeline->Read <= i)
+            pthread_cond_wait(&Pipeline->Changed, &Pipeline->Lock);
+
+        pthread_mutex_unlock(&Pipeline->Lock);
+
+        if (Pipeline->Failed)
+            break;
+
+        RelocateChunk(Pipeline, i, &Offset, &Length);
+
+        bool Written = RelocateTransfer(Pipeline->Descriptor, Pipeline->Buffers[i % RELOCATE_RING_DEPTH],
+                                        Length, Pipeline->To + Offset, true);
+
+        pthread_mutex_lock(&Pipeline->Lock);
+
+        if (Written)
+            Pipeline->Written++;
+        else
+            Pipeline->Failed = true;
+
+        pthread_cond_broadcast(&Pipeline->Changed);
+        pthread_mutex_unlock(&Pipeline->Lock);
+    }
+
+    pthread_join(Reader, NULL);
+    Result = !Pipeline->Failed;
+
+Exit:
+    pthread_cond_destroy(&Pipeline->Changed);
+    pthread_mutex_destroy(&Pipeline->Lock);
+
+    for (size_t i = 0; i < RELOCATE_RING_DEPTH; i++)
+        free(Pipeline->Buffers[i]);
+
+    return Result;
+}
+
+static bool RelocateCopy(int Descriptor, uint64_t From, uint64_t To, uint64_t Size)
+{
+    RELOCATE_PIPELINE Pipeline = {
+        .Descriptor = Descriptor,
+        .From = From,
+        .To = To,
+        .Size = Size,
+        .Backward = To > From,
+        .Chunks = (size_t)((Size + RELOCATE_CHUNK_SIZE - 1) / RELOCATE_CHUNK_SIZE),
+    };
+    uint64_t Distance = To > From ? To - From : From - To;
+    bool Supported = false;
+
+    /* The same file may not overlap within a single copy_file_range call */
+    if (Distance >= RELOCATE_CHUNK_SIZE || Distance >= Size)
+    {
+        if (RelocateCopyOffload(&Pipeline, &Supported))
+            return true;
+
+        if (Supported)
+            return false;
+    }
+
+    return RelocateCopyPipeline(&Pipeline);
+}
+
+static bool RelocateHasSignature(uint8_t *Sector)
+{
+    return Sector[SECTOR_SIZE - 2] == MBR_SIGNATURE_LOW && Sector[SECTOR_SIZE - 1] == MBR_SIGNATURE_HIGH;
+}
+
+/* The backup boot sector keeps a copy of HiddenSectors too, it is only patched when it is really there */
+static bool RelocatePatchBackup(int Descriptor, RELOCATION *Relocation, uint64_t Offset, uint64_t BackupSector,
+                                uint32_t NewStartSector)
+{
+    FAT_VBR *Header = (FAT_VBR *)Relocation->Backup;
+
+    if (!BackupSector)
+        return true;
+
+    if (pread(Descriptor, Relocation->Backup, SECTOR_SIZE, (off_t)(Offset + BackupSector * SECTOR_SIZE)) != SECTOR_SIZE ||
+        !RelocateHasSignature(Relocation->Backup) ||
+        memcmp(Relocation->Backup + offsetof(FAT_VBR, BytesPerSector),
+               Relocation->Primary + offsetof(FAT_VBR, BytesPerSector),
+               offsetof(FAT_VBR, HiddenSectors) - offsetof(FAT_VBR, BytesPerSector)))
+        return true;
+
+    Header->HiddenSectors = NewStartSector;
+
+    return PatchListAdd(&Relocation->Patches, Offset + BackupSector * SECTOR_SIZE, Relocation->Backup, SECTOR_SIZE);
+}
+
+static bool RelocatePatchVbr(int Descriptor, RELOCATION *Relocation, uint32_t NewStartSector)
+{
+    uint64_t Offset = (uint64_t)NewStartSector * SECTOR_SIZE;
+    VBR_INSTALLER *VBR_Installer = VbrDetectFileSystem(Descriptor, Offset, NULL);
+
+    if (!VBR_Installer)
+    {
+        printf(DEBUG_STRING STR_000062);
+        return true;
+    }
+
+    if (pread(Descriptor, Relocation->Primary, SECTOR_SIZE, (off_t)Offset) != SECTOR_SIZE)
+    {
+        printf(DEBUG_STRING STR_000007);
+        return false;
+    }
+
+    char *FileSystem = VBR_Installer->FileSystem;
+    uint64_t BackupSector = 0;
+
+    if (!strcmp(FileSystem, VBR_FILESYSTEM_FAT_STRING) || !strcmp(FileSystem, VBR_FILESYSTEM_NTFS_STRING))
+    {
+        RELOCATE_SET_FIELD(Relocation->Primary, FAT_VBR, HiddenSectors, NewStartSector);
+
+        if (!strcmp(FileSystem, VBR_FILESYSTEM_NTFS_STRING))
+            RELOCATE_GET_FIELD(Relocation->Primary, NTFS_VBR, VolumeSectorCount, BackupSector);
+        else if (IsFat32(Relocation->Primary))
+            RELOCATE_GET_FIELD(Relocation->Primary, FAT32_VBR, BackupBootSector, BackupSector);
+    }
+    else if (!RelocateHasSignature(Relocation->Primary))
+        return true; /* Without boot code the EXT and BTRFS boot sectors hold nothing to patch */
+    else if (!strcmp(FileSystem, VBR_FILESYSTEM_EXT_STRING))
+        RELOCATE_SET_FIELD(Relocation->Primary, EXT_VBR, ExtVolumeStartSector, NewStartSector);
+    else
+        RELOCATE_SET_FIELD(Relocation->Primary, BTRFS_VBR, PartitionStartLBA, NewStartSector);
+
+    return PatchListAdd(&Relocation->Patches, Offset, Relocation->Primary, SECTOR_SIZE) &&
+           RelocatePatchBackup(Descriptor, Relocation, Offset, BackupSector, NewStartSector);
+}
+
+/* BLKRRPART refuses a disk with another partition in use, BLKPG then only touches the slot that changed */
+static bool RelocateUpdateKernel(int Descriptor, uint8_t PartitionNumber, uint8_t NewPartitionNumber,
+                                 uint64_t NewStartSector, uint64_t Sectors)
+{
+    struct blkpg_partition Partition = {
+        .start = (long long)(NewStartSector * SECTOR_SIZE),
+        .length = (long long)(Sectors * SECTOR_SIZE),
+        .pno = PartitionNumber + 1,
+    };
+    struct blkpg_ioctl_arg Argument = {
+        .op = BLKPG_DEL_PARTITION,
+        .datalen = sizeof(Partition),
+        .data = &Partition,
+    };
+
+    if (RereadPartitionTable(Descriptor))
+        return true;
+
+    if (errno != EBUSY)
+        return false;
+
+    if (NewPartitionNumber == PartitionNumber && ioctl(Descriptor, BLKPG, &Argument) && errno != ENXIO)
+        return false;
+
+    Argument.op = BLKPG_ADD_PARTITION;
+    Partition.pno = NewPartitionNumber + 1;
+
+    return !ioctl(Descriptor, BLKPG, &Argument);
+}
+
+static bool RelocateOverlaps(uint64_t Start, uint64_t End, uint64_t OtherStart, uint64_t OtherEnd)
+{
+    return Start < OtherEnd && OtherStart < End;
+}
+
+bool RelocatePartition(char *Device, uint8_t PartitionNumber, uint64_t NewStartSector,
+                       uint8_t NewPartitionNumber)
+{
+    RELOCATION Relocation = {0};
+    LEASE Lease;
+    bool Result = false;
+
+    if (!LeaseAcquire(&Device, 1, &Lease))
+        return false;
+
+    int Descriptor = open(Device, O_RDWR);
+    if (Descriptor == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Device);
+        LeaseRelease(&Lease);
+        return false;
+    }
+
+    int64_t DiskSize = GetFileSize(Device);
+
+    if (DiskSize <= 0 || pread(Descriptor, &Relocation.Mbr, MBR_SIZE, 0) != MBR_SIZE)
+    {
+        printf(DEBUG_STRING STR_000007);
+        goto Exit;
+    }
+
+    MBR_PTE *Source = &Relocation.Mbr.PTE[PartitionNumber];
+    uint64_t Sectors = Source->PartitionSectors;
+    uint64_t NewEndSector = NewStartSector + Sectors;
+
+    if (!Source->PartitionType || !Sectors)
+    {
+        printf(DEBUG_STRING STR_000059, PartitionNumber + 1);
+        goto Exit;
+    }
+
+    /* The file system would keep writing to the old location behind our back */
+    if (OnlineIsPartitionMounted(Device, Source->LBAStartAddress))
+    {
+        printf(DEBUG_STRING STR_000084, PartitionNumber + 1, Device);
+        goto Exit;
+    }
+
+    /* The new range has to fit on the disk and stay clear of every other partition */
+    bool Valid = NewStartSector && NewEndSector <= (uint64_t)DiskSize / SECTOR_SIZE && NewEndSector <= UINT32_MAX;
+
+    if (NewPartitionNumber != PartitionNumber && Relocation.Mbr.PTE[NewPartitionNumber].PartitionType)
+        Valid = false;
+
+    for (int i = 0; i < 4 && Valid; i++)
+    {
+        MBR_PTE *PTE = &Relocation.Mbr.PTE[i];
+
+        if (i == NewPartitionNumber || (i == PartitionNumber && NewPartitionNumber == PartitionNumber) ||
+            !PTE->PartitionType)
+            continue;
+
+        if (RelocateOverlaps(NewStartSector, NewEndSector, PTE->LBAStartAddress,
+                             (uint64_t)PTE->LBAStartAddress + PTE->PartitionSectors))
+            Valid = false;
+    }
+
+    if (!Valid)
+    {
+        printf(DEBUG_STRING STR_000060, (unsigned long long)NewStartSector, (unsigned long long)NewEndSector);
+        goto Exit;
+    }
+
+    if (!RelocateCopy(Descriptor, (uint64_t)Source->LBAStartAddress * SECTOR_SIZE,
+                      NewStartSector * SECTOR_SIZE, Sectors * SECTOR_SIZE))
+    {
+        printf(DEBUG_STRING STR_000061, Device);
+        goto Exit;
+    }
+
+    /* The data is durable before the partition table points at it */
+    if (fdatasync(Descriptor))
+    {
+        printf(DEBUG_STRING STR_000024);
+        goto Exit;
+    }
+
+    if (!RelocatePatchVbr(Descriptor, &Relocation, (uint32_t)NewStartSector))
+        goto Exit;
+
+    MBR_PTE *Dest = &Relocation.Mbr.PTE[NewPartitionNumber];
+
+    /* A clone gets the same entry in its own slot, only the move keeps the boot flag */
+    *Dest = *Source;
+
+    if (NewPartitionNumber != PartitionNumber)
+        Dest->Attributes = 0;
+
+    Dest->LBAStartAddress = (uint32_t)NewStartSector;
+    MbrLbaToChs(NewStartSector, Dest->CHSAddressStart);
+    MbrLbaToChs(NewEndSector - 1, Dest->CHSAddressEnd);
+
+    /* The partition table goes last, it only moves once the boot sectors agree with it */
+    if (!PatchListAdd(&Relocation.Patches, 0, &Relocation.Mbr, MBR_SIZE))
+        goto Exit;
+
+    if (!PatchListWrite(Descriptor, &Relocation.Patches))
+    {
+        printf(DEBUG_STRING STR_000025, Device);
+        goto Exit;
+    }
+
+    if (!SyncHandle(Descriptor))
+    {
+        printf(DEBUG_STRING STR_000024);
+        goto Exit;
+    }
+
+    /* The data and the table are already in place, only the kernel view can lag behind */
+    if (!RelocateUpdateKernel(Descriptor, PartitionNumber, NewPartitionNumber, NewStartSector, Sectors))
+        printf(DEBUG_STRING STR_000083, Device);
+
+    printf(DEBUG_STRING STR_000063, PartitionNumber + 1, NewPartitionNumber + 1,
+           (unsigned long long)NewStartSector, (unsigned long long)NewEndSector);
+
+    Result = true;
+
+Exit:
+    PatchListFree(&Relocation.Patches);
+    close(Descriptor);
+    LeaseRelease(&Lease);
+    return Result;
+}
@@ -0,0 +1,324 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to find lost partitions from their boot sectors and superblocks
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <scan.h>
+#include <lib/thread.h>
+
+typedef struct _SCAN_STATE
+{
+    int Descriptor;
+    uint64_t Size;
+    SCAN_CANDIDATE *Candidates;
+    size_t Count;
+    size_t Capacity;
+    uint8_t *Buffers[PARALLEL_MAX_THREADS];
+    size_t FreeBuffers;
+    bool Failed;
+    pthread_mutex_t Lock;
+} SCAN_STATE;
+
+static void ScanAdd(SCAN_STATE *State, char *FileSystem, uint64_t StartSector, uint64_t Sectors,
+                    uint64_t BackupSector)
+{
+    pthread_mutex_lock(&State->Lock);
+
+    if (State->Count == State->Capacity)
+    {
+        size_t Capacity = State->Capacity ? State->Capacity * 2 : 16;
+        SCAN_CANDIDATE *Resized = realloc(State->Candidates, Capacity * sizeof(SCAN_CANDIDATE));
+
+        if (!Resized)
+        {
+            State->Failed = true;
+            pthread_mutex_unlock(&State->Lock);
+            return;
+        }
+
+        State->Candidates = Resized;
+        State->Capacity = Capacity;
+    }
+
+    State->Candidates[State->Count++] = (SCAN_CANDIDATE){
+        .FileSystem = FileSystem,
+        .StartSector = StartSector,
+        .EndSector = StartSector + Sectors,
+        .BackupSector = BackupSector,
+    };
+
+    pthread_mutex_unlock(&State->Lock);
+}
+
+static bool ScanIsPowerOfTwo(uint32_t Value)
+{
+    return Value && !(Value & (Value - 1));
+}
+
+/* A 0x55AA sector only counts when its BPB holds together */
+static void ScanBootSector(SCAN_STATE *State, uint8_t *Sector, uint64_t LBA)
+{
+    FAT_VBR *FatVBR = (FAT_VBR *)Sector;
+    NTFS_VBR *NtfsVBR = (NTFS_VBR *)Sector;
+
+    if (FatVBR->BytesPerSector < SECTOR_SIZE || FatVBR->BytesPerSector > SCAN_CHUNK_ALIGNMENT ||
+        !ScanIsPowerOfTwo(FatVBR->BytesPerSector))
+        return;
+
+    uint64_t Scale = FatVBR->BytesPerSector / SECTOR_SIZE;
+
+    if (!memcmp(NtfsVBR->OemId, VBR_FILESYSTEM_OEM_NTFS_STRING, sizeof(NtfsVBR->OemId)))
+    {
+        if (!NtfsVBR->VolumeSectorCount)
+            return;
+
+        uint64_t BackupSector = NtfsVBR->VolumeSectorCount * Scale;
+
+        /* The backup at the end of the volume still tells where the volume starts */
+        if (NtfsVBR->HiddenSectors && NtfsVBR->HiddenSectors + BackupSector == LBA)
+            LBA = NtfsVBR->HiddenSectors;
+
+        /* The backup boot sector past the volume belongs to the partition too */
+        ScanAdd(State, VBR_FILESYSTEM_NTFS_STRING, LBA, BackupSector + Scale, BackupSector);
+        return;
+    }
+
+    if (!ScanIsPowerOfTwo(FatVBR->SectorsPerCluster) ||
+        !FatVBR->ReservedSectors || !FatVBR->NumberOfFats || FatVBR->NumberOfFats > 2)
+        return;
+
+    uint64_t Sectors = FatVBR->TotalSectors ? FatVBR->TotalSectors : FatVBR->TotalSectorsBig;
+
+    if (!Sectors)
+        return;
+
+    uint64_t BackupSector = 0;
+
+    if (IsFat32(Sector))
+    {
+        FAT32_VBR *Fat32VBR = (FAT32_VBR *)Sector;
+
+        if (FatVBR->SectorsPerFat || !Fat32VBR->SectorsPerFatBig)
+            return;
+
+        BackupSector = Fat32VBR->BackupBootSector * Scale;
+
+        /* The backup boot record sits a few sectors past the one it mirrors */
+        if (BackupSector && FatVBR->HiddenSectors && FatVBR->HiddenSectors + BackupSector == LBA)
+            LBA = FatVBR->HiddenSectors;
+    }
+    else
+    {
+        FAT16_VBR *Fat16VBR = (FAT16_VBR *)Sector;
+
+        if (!FatVBR->SectorsPerFat ||
+            strncasecmp((char *)Fat16VBR->FileSystemType, VBR_FILESYSTEM_TYPE_FAT_STRING,
+                        strlen(VBR_FILESYSTEM_TYPE_FAT_STRING)))
+            return;
+    }
+
+    ScanAdd(State, VBR_FILESYSTEM_FAT_STRING, LBA, Sectors * Scale, BackupSector);
+}
+
+/* The superblock lives 1KiB past the start of the volume, its first sector has everything needed */
+static void ScanExtSuperBlock(SCAN_STATE *State, uint8_t *Sector, uint64_t LBA)
+{
+    uint8_t Buffer[VBR_FILESYSTEM_EXT_SIZE] = {0};
+    EXT_VBR *ExtVBR = (EXT_VBR *)Buffer;
+    uint64_t SuperBlockSectors = SCAN_EXT_SUPERBLOCK_OFFSET / SECTOR_SIZE;
+
+    if (LBA < SuperBlockSectors)
+        return;
+
+    memcpy(&Buffer[SCAN_EXT_SUPERBLOCK_OFFSET], Sector, SECTOR_SIZE);
+
+    if (ExtVBR->LogBlockSize > SCAN_EXT_MAX_LOG_BLOCK_SIZE || !ExtVBR->BlocksPerGroup ||
+        !ExtVBR->InodesPerGroup || !ExtVBR->BlocksCountLo || ExtVBR->FirstDataBlock > 1)
+        return;
+
+    /* Backup superblocks of the block groups record which group they belong to */
+    if (ExtVBR->RevLevel && ExtVBR->BlockGroupNr)
+        return;
+
+    uint64_t Sectors = (uint64_t)ExtVBR->BlocksCountLo * ((1024u << ExtVBR->LogBlockSize) / SECTOR_SIZE);
+
+    ScanAdd(State, VBR_FILESYSTEM_EXT_STRING, LBA - SuperBlockSectors, Sectors, 0);
+}
+
+static void ScanBtrfsSuperBlock(SCAN_STATE *State, uint8_t *Sector, uint64_t LBA)
+{
+    uint64_t SuperBlockSectors = SCAN_BTRFS_SUPERBLOCK_OFFSET / SECTOR_SIZE;
+    uint64_t ByteNr, TotalBytes;
+
+    if (LBA < SuperBlockSectors)
+        return;
+
+    memcpy(&ByteNr, &Sector[SCAN_BTRFS_BYTENR_OFFSET], sizeof(ByteNr));
+    memcpy(&TotalBytes, &Sector[SCAN_BTRFS_TOTAL_BYTES_OFFSET], sizeof(TotalBytes));
+
+    /* The mirrors further in the volume carry their own offset */
+    if (ByteNr != SCAN_BTRFS_SUPERBLOCK_OFFSET || !TotalBytes)
+        return;
+
+    ScanAdd(State, VBR_FILESYSTEM_BTRFS_STRING, LBA - SuperBlockSectors, TotalBytes / SECTOR_SIZE, 0);
+}
+
+static void ScanChunk(size_t Index, void *Context)
+{
+    SCAN_STATE *State = Context;
+    uint64_t Offset = (uint64_t)Index * SCAN_CHUNK_SIZE;
+    size_t Size = State->Size - Offset < SCAN_CHUNK_SIZE ? (size_t)(State->Size - Offset) : SCAN_CHUNK_SIZE;
+    size_t Done = 0;
+    uint8_t *Buffer = NULL;
+
+    /* Buffers go back to the pool, a fresh one per chunk would fault every page in again */
+    pthread_mutex_lock(&State->Lock);
+
+    if (State->FreeBuffers)
+        Buffer = State->Buffers[--State->FreeBuffers];
+
+    pthread_mutex_unlock(&State->Lock);
+
+    if (!Buffer && posix_memalign((void **)&Buffer, SCAN_CHUNK_ALIGNMENT, SCAN_CHUNK_SIZE))
+    {
+        State->Failed = true;
+        return;
+    }
+
+    while (Done < Size)
+    {
+        ssize_t Count = pread(State->Descriptor, Buffer + Done, Size - Done, (off_t)(Offset + Done));
+
+        if (Count <= 0)
+        {
+            if (Count < 0)
+                State->Failed = true;
+
+            break;
+        }
+
+        Done += (size_t)Count;
+    }
+
+    /* Signatures sit at fixed offsets, every sector costs a couple of compares */
+    uint16_t BtrfsMagicOffset = VBR_FILESYSTEM_SIGNATURE_BTRFS_OFFSET - SCAN_BTRFS_SUPERBLOCK_OFFSET;
+    uint16_t ExtMagicOffset = offsetof(EXT_VBR, Magic) - SCAN_EXT_SUPERBLOCK_OFFSET;
+
+    for (size_t i = 0; i + SECTOR_SIZE <= Done; i += SECTOR_SIZE)
+    {
+        uint8_t *Sector = &Buffer[i];
+        uint64_t LBA = (Offset + i) / SECTOR_SIZE;
+
+        if (Sector[SECTOR_SIZE - 2] == MBR_SIGNATURE_LOW && Sector[SECTOR_SIZE - 1] == MBR_SIGNATURE_HIGH)
+            ScanBootSector(State, Sector, LBA);
+
+        if (Sector[ExtMagicOffset] == (VBR_FILESYSTEM_SIGNATURE_EXT & 0xFF) &&
+            Sector[ExtMagicOffset + 1] == (VBR_FILESYSTEM_SIGNATURE_EXT >> 8))
+            ScanExtSuperBlock(State, Sector, LBA);
+
+        if (Sector[BtrfsMagicOffset] == VBR_FILESYSTEM_SIGNATURE_BTRFS[0] &&
+            !memcmp(&Sector[BtrfsMagicOffset], VBR_FILESYSTEM_SIGNATURE_BTRFS,
+                    sizeof(VBR_FILESYSTEM_SIGNATURE_BTRFS) - 1))
+            ScanBtrfsSuperBlock(State, Sector, LBA);
+    }
+
+    pthread_mutex_lock(&State->Lock);
+    State->Buffers[State->FreeBuffers++] = Buffer;
+    pthread_mutex_unlock(&State->Lock);
+}
+
+static int ScanCompare(const void *First, const void *Second)
+{
+    const SCAN_CANDIDATE *A = First, *B = Second;
+
+    if (A->StartSector != B->StartSector)
+        return A->StartSector < B->StartSector ? -1 : 1;
+
+    return strcmp(A->FileSystem, B->FileSystem);
+}
+
+/* A backup whose start could not be told from its BPB shows up shifted, it is dropped once its primary is found */
+static bool ScanIsDuplicate(SCAN_CANDIDATE *Candidates, size_t Index)
+{
+    SCAN_CANDIDATE *Candidate = &Candidates[Index];
+
+    for (size_t i = 0; i < Index; i++)
+    {
+        SCAN_CANDIDATE *Primary = &Candidates[i];
+
+        if (strcmp(Primary->FileSystem, Candidate->FileSystem) ||
+            Primary->EndSector - Primary->StartSector != Candidate->EndSector - Candidate->StartSector)
+            continue;
+
+        if (Primary->StartSector == Candidate->StartSector ||
+            (Primary->BackupSector && Primary->StartSector + Primary->BackupSector == Candidate->StartSector))
+            return true;
+    }
+
+    return false;
+}
+
+bool ScanDevice(char *Device)
+{
+    SCAN_STATE State = {
+        .Lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    int64_t Size = GetFileSize(Device);
+
+    if (Size <= 0)
+    {
+        printf(DEBUG_STRING STR_000002, Device);
+        return false;
+    }
+
+    State.Size = (uint64_t)Size;
+    State.Descriptor = open(Device, O_RDONLY);
+
+    if (State.Descriptor == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Device);
+        return false;
+    }
+
+    posix_fadvise(State.Descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    /* One chunk per worker at a time, enough of them in flight to keep the disk queue full */
+    long Processors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t Chunks = (size_t)((State.Size + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE);
+
+    ParallelFor(Chunks, Processors > 0 ? (size_t)Processors : 0, ScanChunk, &State);
+    close(State.Descriptor);
+
+    for (size_t i = 0; i < State.FreeBuffers; i++)
+        free(State.Buffers[i]);
+
+    if (State.Failed)
+    {
+        printf(DEBUG_STRING STR_000007);
+        free(State.Candidates);
+        return false;
+    }
+
+    qsort(State.Candidates, State.Count, sizeof(SCAN_CANDIDATE), ScanCompare);
+
+    for (size_t i = 0; i < State.Count; i++)
+    {
+        SCAN_CANDIDATE *Candidate = &State.Candidates[i];
+
+        if (ScanIsDuplicate(State.Candidates, i))
+            continue;
+
+        printf(STR_000053, Candidate->FileSystem,
+               (unsigned long long)Candidate->StartSector,
+               (unsigned long long)Candidate->EndSector,
+               (unsigned long long)(Candidate->EndSector - Candidate->StartSector));
+    }
+
+    if (!State.Count)
+        printf(DEBUG_STRING STR_000054);
+
+    free(State.Candidates);
+    return State.Count != 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to install a contiguous stage 2 loader next to the boot code
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <stage2.h>
+#include <patch.h>
+#include <sync.h>
+
+char *Stage2File = NULL;
+STAGE2_LOCATION Stage2Location = Stage2LocationNone;
+
+bool Stage2ParseLocation(char *String)
+{
+    if (!strcasecmp(String, STAGE2_LOCATION_MBRGAP_STRING))
+        Stage2Location = Stage2LocationMbrGap;
+    else if (!strcasecmp(String, STAGE2_LOCATION_RESERVED_STRING))
+        Stage2Location = Stage2LocationReserved;
+    else
+    {
+        printf(DEBUG_STRING STR_000038, String);
+        return false;
+    }
+
+    return true;
+}
+
+static STAGE2_DESCRIPTOR *Stage2FindDescriptor(void *BootCode, size_t Size)
+{
+    uint8_t *Buffer = BootCode;
+
+    for (size_t i = 0; i + sizeof(STAGE2_DESCRIPTOR) <= Size; i++)
+    {
+        if (!memcmp(&Buffer[i], STAGE2_SIGNATURE, sizeof(((STAGE2_DESCRIPTOR *)0)->Signature)))
+            return (STAGE2_DESCRIPTOR *)&Buffer[i];
+    }
+
+    return NULL;
+}
+
+static void *Stage2ReadFile(uint32_t *Size)
+{
+    int64_t size = GetFileSize(Stage2File);
+
+    if (size <= 0)
+    {
+        printf(DEBUG_STRING STR_000002, Stage2File);
+        return NULL;
+    }
+
+    if (size > STAGE2_SIZE_LIMIT)
+    {
+        printf(DEBUG_STRING STR_000042);
+        return NULL;
+    }
+
+    /* Padded to whole sectors, the loader reads it back in sector units */
+    *Size = ((uint32_t)size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+    void *Buffer = calloc(1, *Size);
+    FILE *Bin = fopen(Stage2File, "rb");
+
+    if (!Buffer || !Bin || fread(Buffer, 1, (size_t)size, Bin) != (size_t)size)
+    {
+        printf(DEBUG_STRING STR_000004);
+        free(Buffer);
+
+        if (Bin)
+            fclose(Bin);
+
+        return NULL;
+    }
+
+    fclose(Bin);
+
+    return Buffer;
+}
+
+static bool Stage2IsFree(int Descriptor, uint64_t Offset, uint64_t BaseLBA,
+                         uint64_t FirstSector, uint32_t Sectors, STAGE2_DESCRIPTOR *Previous)
+{
+    size_t Size = (size_t)Sectors * SECTOR_SIZE;
+    uint8_t *Buffer = malloc(Size);
+    bool Result = true;
+
+    if (!Buffer)
+    {
+        printf(DEBUG_STRING STR_000004);
+        return false;
+    }
+
+    if (pread(Descriptor, Buffer, Size, (off_t)(Offset + FirstSector * SECTOR_SIZE)) != (ssize_t)Size)
+    {
+        printf(DEBUG_STRING STR_000007);
+        free(Buffer);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < Sectors && Result; i++)
+    {
+        uint64_t LBA = BaseLBA + FirstSector + i;
+
+        /* Sectors of a previously installed stage 2 can be reused */
+        if (Previous && LBA >= Previous->StartLBA && LBA < Previous->StartLBA + Previous->Sectors)
+            continue;
+
+        for (size_t j = 0; j < SECTOR_SIZE; j++)
+        {
+            if (Buffer[(size_t)i * SECTOR_SIZE + j])
+            {
+                Result = false;
+                break;
+            }
+        }
+    }
+
+    free(Buffer);
+    return Result;
+}
+
+static bool Stage2Place(int Descriptor, uint64_t Offset, uint64_t BaseLBA,
+                        uint64_t FirstSector, uint64_t EndSector,
+                        STAGE2_DESCRIPTOR *Previous, STAGE2_DESCRIPTOR *Current,
+                        STAGE2 *Stage2)
+{
+    if (!Current)
+    {
+        printf(DEBUG_STRING STR_000039);
+        return false;
+    }
+
+    Stage2->Buffer = Stage2ReadFile(&Stage2->Size);
+    if (!Stage2->Buffer)
+        return false;
+
+    uint32_t Sectors = Stage2->Size / SECTOR_SIZE;
+    uint64_t FreeSectors = EndSector > FirstSector ? EndSector - FirstSector : 0;
+
+    if (Sectors > FreeSectors)
+    {
+        printf(DEBUG_STRING STR_000040, Sectors, (unsigned long long)FreeSectors);
+        Stage2Free(Stage2);
+        return false;
+    }
+
+    if (!Stage2IsFree(Descriptor, Offset, BaseLBA, FirstSector, Sectors, Previous))
+    {
+        printf(DEBUG_STRING STR_000041);
+        Stage2Free(Stage2);
+        return false;
+    }
+
+    Current->StartLBA = BaseLBA + FirstSector;
+    Current->Sectors = Sectors;
+
+    Stage2->Offset = Offset + FirstSector * SECTOR_SIZE;
+
+    return true;
+}
+
+bool Stage2PlaceMbrGap(int Descriptor, MBR *Previous, MBR *Dest, STAGE2 *Stage2)
+{
+    uint64_t EndSector = 0;
+
+    /* The gap ends where the first partition starts, a protective GPT entry leaves none */
+    for (int i = 0; i < 4; i++)
+    {
+        MBR_PTE *PTE = &Dest->PTE[i];
+
+        if (!PTE->PartitionType || !PTE->LBAStartAddress)
+            continue;
+
+        if (!EndSector || PTE->LBAStartAddress < EndSector)
+            EndSector = PTE->LBAStartAddress;
+    }
+
+    return Stage2Place(Descriptor, 0, 0, 1, EndSector,
+                       Stage2FindDescriptor(Previous->MBRCode, sizeof(Previous->MBRCode)),
+                       Stage2FindDescriptor(Dest->MBRCode, sizeof(Dest->MBRCode)),
+                       Stage2);
+}
+
+bool Stage2PlaceFatReserved(int Descriptor, uint64_t Offset, uint16_t VBRSize,
+                            void *Previous, void *Dest, STAGE2 *Stage2)
+{
+    FAT32_VBR *DestVBR = Dest;
+
+    if (!IsFat32(Dest))
+    {
+        printf(DEBUG_STRING STR_000043);
+        return false;
+    }
+
+    /* Skip the boot record, the FsInfo sector and the backup boot record */
+    uint64_t FirstSector = STAGE2_FAT32_BOOT_RECORD_SECTORS;
+
+    if (DestVBR->FsInfo + 1u > FirstSector)
+        FirstSector = DestVBR->FsInfo + 1u;
+
+    if (DestVBR->BackupBootSector && DestVBR->BackupBootSector + STAGE2_FAT32_BOOT_RECORD_SECTORS > FirstSector)
+        FirstSector = DestVBR->BackupBootSector + STAGE2_FAT32_BOOT_RECORD_SECTORS;
+
+    return Stage2Place(Descriptor, Offset, DestVBR->Header.HiddenSectors,
+                       FirstSector, DestVBR->Header.ReservedSectors,
+                       Stage2FindDescriptor(Previous, VBRSize),
+                       Stage2FindDescriptor(Dest, VBRSize),
+                       Stage2);
+}
+
+bool Stage2Install(char *Device, STAGE2_LOCATION Location, uint16_t VBRSize, void *Previous, void *Dest)
+{
+    STAGE2 Stage2 = {0};
+    PATCH_LIST Patches = {0};
+    bool Result = false;
+
+    int Descriptor = open(Device, O_RDWR);
+    if (Descriptor == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Device);
+        return false;
+    }
+
+    if (Location == Stage2LocationMbrGap)
+        Result = Stage2PlaceMbrGap(Descriptor, Previous, Dest, &Stage2);
+    else
+        Result = Stage2PlaceFatReserved(Descriptor, 0, VBRSize, Previous, Dest, &Stage2);
+
+    /* Written before the boot code that points to it */
+    if (Result)
+    {
+        Result = PatchListAdd(&Patches, Stage2.Offset, Stage2.Buffer, Stage2.Size) &&
+                 PatchListWrite(Descriptor, &Patches) &&
+                 SyncHandle(Descriptor);
+
+        if (!Result)
+            printf(DEBUG_STRING STR_000025, Device);
+    }
+
+    PatchListFree(&Patches);
+    Stage2Free(&Stage2);
+    close(Descriptor);
+    return Result;
+}
+
+void Stage2Free(STAGE2 *Stage2)
+{
+    free(Stage2->Buffer);
+    Stage2->Buffer = NULL;
+}
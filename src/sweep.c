@@ -0,0 +1,70 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to map each detected file system to its VBR file
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <sweep.h>
+
+bool SweepMode;
+
+static SWEEP_RULE SweepRules[SWEEP_MAX_RULES];
+static size_t SweepRuleCount;
+
+static SWEEP_RULE *SweepFindName(char *FileSystem)
+{
+    for (size_t i = 0; i < SweepRuleCount; i++)
+    {
+        if (!strcasecmp(SweepRules[i].FileSystem, FileSystem))
+            return &SweepRules[i];
+    }
+
+    return NULL;
+}
+
+bool SweepParseRules(char *String)
+{
+    char *SavePointer;
+
+    SweepRuleCount = 0;
+
+    for (char *Token = strtok_r(String, ",", &SavePointer); Token; Token = strtok_r(NULL, ",", &SavePointer))
+    {
+        char *Value = strchr(Token, '=');
+
+        if (Value)
+            *Value++ = '\0';
+
+        /* FAT16 and FAT32 take different boot code, they can be told apart from the plain FAT rule */
+        if (!Value || !*Value || SweepRuleCount == SWEEP_MAX_RULES || SweepFindName(Token) ||
+            (!VbrFindInstaller(Token) && strcasecmp(Token, SWEEP_FILESYSTEM_FAT16_STRING) &&
+             strcasecmp(Token, SWEEP_FILESYSTEM_FAT32_STRING)))
+        {
+            printf(DEBUG_STRING STR_000075, Token);
+            return false;
+        }
+
+        SweepRules[SweepRuleCount].FileSystem = Token;
+        SweepRules[SweepRuleCount].File = Value;
+        SweepRuleCount++;
+    }
+
+    SweepMode = SweepRuleCount != 0;
+
+    if (!SweepMode)
+        printf(DEBUG_STRING STR_000075, String);
+
+    return SweepMode;
+}
+
+SWEEP_RULE *SweepFindRule(VBR_INSTALLER *VBR_Installer, uint16_t VBRSize)
+{
+    SWEEP_RULE *Rule = NULL;
+
+    if (!strcmp(VBR_Installer->FileSystem, VBR_FILESYSTEM_FAT_STRING))
+        Rule = SweepFindName(VBRSize == VBR_FILESYSTEM_FAT32_SIZE ? SWEEP_FILESYSTEM_FAT32_STRING
+                                                                   : SWEEP_FILESYSTEM_FAT16_STRING);
+
+    return Rule ? Rule : SweepFindName(VBR_Installer->FileSystem);
+}
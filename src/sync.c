@@ -0,0 +1,223 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to make the flashed sectors durable
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <sync.h>
+#include <lib/thread.h>
+
+SYNC_MODE DurabilityMode = SyncModeNone;
+bool DurabilityModeGiven = false;
+
+/* Descriptors kept open until the barrier, the last close of a block device would flush it serially */
+static SYNC_PENDING *SyncPending = NULL;
+static size_t SyncPendingCount = 0, SyncPendingCapacity = 0;
+static pthread_mutex_t SyncPendingLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* What the barrier could not flush, so every target can be reported on its own */
+static SYNC_IDENTITY *SyncFailures = NULL;
+static size_t SyncFailureCount = 0;
+
+/* A partition is flushed along with its disk, both are reported under the disk */
+static bool SyncIdentify(struct stat *statbuf, SYNC_IDENTITY *Identity)
+{
+    if (S_ISBLK(statbuf->st_mode))
+    {
+        if (GetBlockDisks(statbuf->st_rdev, &Identity->Device, 1) != 1)
+            Identity->Device = statbuf->st_rdev;
+
+        Identity->Inode = 0;
+        return true;
+    }
+
+    Identity->Device = statbuf->st_dev;
+    Identity->Inode = statbuf->st_ino;
+    return true;
+}
+
+static bool SyncDescriptor(int Descriptor)
+{
+    struct stat statbuf;
+
+    if (fstat(Descriptor, &statbuf) == -1)
+        return false;
+
+    /* The block device fsync already issues the cache flush, there is no metadata to persist */
+    if (S_ISBLK(statbuf.st_mode))
+        return fdatasync(Descriptor) == 0;
+
+    /* Pipes and terminals have nothing to persist */
+    if (!S_ISREG(statbuf.st_mode))
+        return true;
+
+    return fsync(Descriptor) == 0;
+}
+
+bool SyncParseMode(char *String)
+{
+    if (!strcasecmp(String, SYNC_MODE_NONE_STRING))
+        DurabilityMode = SyncModeNone;
+    else if (!strcasecmp(String, SYNC_MODE_TARGET_STRING))
+        DurabilityMode = SyncModeTarget;
+    else if (!strcasecmp(String, SYNC_MODE_GROUP_STRING))
+        DurabilityMode = SyncModeGroup;
+    else
+    {
+        printf(DEBUG_STRING STR_000023, String);
+        return false;
+    }
+
+    DurabilityModeGiven = true;
+    return true;
+}
+
+bool SyncHandle(int Descriptor)
+{
+    switch (DurabilityMode)
+    {
+    case SyncModeTarget:
+        return SyncDescriptor(Descriptor);
+
+    case SyncModeGroup:
+    {
+        struct stat statbuf;
+        SYNC_IDENTITY Identity;
+
+        if (fstat(Descriptor, &statbuf) == -1 || !SyncIdentify(&statbuf, &Identity))
+            return false;
+
+        int Duplicate = dup(Descriptor);
+        if (Duplicate == -1)
+            return false;
+
+        pthread_mutex_lock(&SyncPendingLock);
+
+        if (SyncPendingCount == SyncPendingCapacity)
+        {
+            size_t Capacity = SyncPendingCapacity ? SyncPendingCapacity * 2 : 16;
+            SYNC_PENDING *Resized = realloc(SyncPending, Capacity * sizeof(SYNC_PENDING));
+
+            if (!Resized)
+            {
+                pthread_mutex_unlock(&SyncPendingLock);
+                close(Duplicate);
+                return SyncDescriptor(Descriptor);
+            }
+
+            SyncPending = Resized;
+            SyncPendingCapacity = Capacity;
+        }
+
+        SyncPending[SyncPendingCount].Descriptor = Duplicate;
+        SyncPending[SyncPendingCount].Identity = Identity;
+        SyncPendingCount++;
+        pthread_mutex_unlock(&SyncPendingLock);
+        return true;
+    }
+
+    default:
+        return true;
+    }
+}
+
+bool SyncHandleForced(int Descriptor)
+{
+    /* Flushed even when the durability mode would leave it cached */
+    if (DurabilityMode == SyncModeNone)
+        return SyncDescriptor(Descriptor);
+
+    return SyncHandle(Descriptor);
+}
+
+bool SyncFile(FILE *File)
+{
+    if (fflush(File))
+        return false;
+
+    return SyncHandle(fileno(File));
+}
+
+static void SyncPendingDescriptor(size_t Index, void *Context)
+{
+    bool *Results = Context;
+
+    Results[Index] = SyncDescriptor(SyncPending[Index].Descriptor);
+}
+
+static void SyncReportFailure(SYNC_PENDING *Pending)
+{
+    char Link[64], Path[PATH_MAX];
+
+    snprintf(Link, sizeof(Link), SYNC_DESCRIPTOR_LINK_PATH "/%d", Pending->Descriptor);
+
+    ssize_t Length = readlink(Link, Path, sizeof(Path) - 1);
+
+    Path[Length > 0 ? Length : 0] = '\0';
+    printf(DEBUG_STRING STR_000088, Length > 0 ? Path : Link);
+
+    for (size_t i = 0; i < SyncFailureCount; i++)
+    {
+        if (SyncFailures[i].Device == Pending->Identity.Device && SyncFailures[i].Inode == Pending->Identity.Inode)
+            return;
+    }
+
+    SYNC_IDENTITY *Resized = realloc(SyncFailures, (SyncFailureCount + 1) * sizeof(SYNC_IDENTITY));
+
+    if (Resized)
+    {
+        SyncFailures = Resized;
+        SyncFailures[SyncFailureCount++] = Pending->Identity;
+    }
+}
+
+bool SyncBarrier(void)
+{
+    bool Result = true;
+
+    if (!SyncPendingCount)
+        return Result;
+
+    bool *Results = calloc(SyncPendingCount, sizeof(bool));
+    if (!Results)
+    {
+        printf(DEBUG_STRING STR_000004);
+        return false;
+    }
+
+    ParallelFor(SyncPendingCount, 0, SyncPendingDescriptor, Results);
+
+    for (size_t i = 0; i < SyncPendingCount; i++)
+    {
+        if (!Results[i])
+            SyncReportFailure(&SyncPending[i]);
+
+        Result &= Results[i];
+        close(SyncPending[i].Descriptor);
+    }
+
+    free(Results);
+    free(SyncPending);
+    SyncPending = NULL;
+    SyncPendingCount = SyncPendingCapacity = 0;
+
+    return Result;
+}
+
+bool SyncFailed(char *Device)
+{
+    struct stat statbuf;
+    SYNC_IDENTITY Identity;
+
+    if (!SyncFailureCount || !Device || stat(Device, &statbuf) == -1 || !SyncIdentify(&statbuf, &Identity))
+        return false;
+
+    for (size_t i = 0; i < SyncFailureCount; i++)
+    {
+        if (SyncFailures[i].Device == Identity.Device && SyncFailures[i].Inode == Identity.Inode)
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,543 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to discover and select block device targets from sysfs
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <target.h>
+#include <sync.h>
+#include <lib/thread.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/sysmacros.h>
+
+typedef struct _TARGET_TRANSPORT
+{
+    char *PathComponent;
+    char *Transport;
+} TARGET_TRANSPORT;
+
+/* Ordered from the outermost bus to the innermost one, like lsblk does */
+TARGET_TRANSPORT Target_Transports[] = {
+    {"/usb", "usb"},
+    {"/nvme", "nvme"},
+    {"/mmc_host", "mmc"},
+    {"/virtio", "virtio"},
+    {"/ata", "sata"},
+    {"/host", "scsi"},
+};
+
+/* Never real removable media, and never the target of a bulk flash */
+char *Target_VirtualPrefixes[] = {"loop", "ram", "zram", "dm-", "md", "sr"};
+
+static dev_t Target_SystemDisks[TARGET_MAX_SYSTEM_DISKS];
+static size_t Target_SystemDiskCount;
+static pthread_once_t Target_SystemDisksOnce = PTHREAD_ONCE_INIT;
+
+typedef struct _TARGET_DISCOVERY
+{
+    TARGET_FILTER *Filter;
+    TARGET *Targets;
+    uint8_t PartitionNumber;
+} TARGET_DISCOVERY;
+
+static bool TargetParseSize(char *String, uint64_t *Size)
+{
+    char *End;
+    int Shift = 0;
+
+    if (*String < '0' || *String > '9')
+        return false;
+
+    errno = 0;
+    *Size = strtoull(String, &End, 0);
+
+    if (errno || End == String)
+        return false;
+
+    switch (*End)
+    {
+    case 'T':
+    case 't':
+        Shift += 10;
+        /* fall through */
+    case 'G':
+    case 'g':
+        Shift += 10;
+        /* fall through */
+    case 'M':
+    case 'm':
+        Shift += 10;
+        /* fall through */
+    case 'K':
+    case 'k':
+        Shift += 10;
+        End++;
+        break;
+    }
+
+    if (*End || (Shift && *Size > (UINT64_MAX >> Shift)))
+        return false;
+
+    *Size <<= Shift;
+    return true;
+}
+
+static bool TargetReadAttribute(char *Name, char *Attribute, char *Buffer, size_t BufferSize)
+{
+    char Path[PATH_MAX];
+
+    if (snprintf(Path, sizeof(Path), TARGET_SYSFS_BLOCK_PATH "/%s/%s", Name, Attribute) >= (int)sizeof(Path))
+        return false;
+
+    FILE *File = fopen(Path, "r");
+    if (!File)
+        return false;
+
+    size_t Count = fread(Buffer, 1, BufferSize - 1, File);
+    fclose(File);
+
+    /* Sysfs values are padded with spaces and end with a new line */
+    while (Count && (Buffer[Count - 1] == '\n' || Buffer[Count - 1] == ' '))
+        Count--;
+
+    Buffer[Count] = '\0';
+
+    return Count != 0;
+}
+
+static void TargetReadSerial(char *Name, char *Serial, size_t SerialSize)
+{
+    if (!TargetReadAttribute(Name, "device/serial", Serial, SerialSize) &&
+        !TargetReadAttribute(Name, "serial", Serial, SerialSize) &&
+        !TargetReadAttribute(Name, "device/wwid", Serial, SerialSize))
+        Serial[0] = '\0';
+}
+
+static bool TargetMatchString(char *Pattern, char *String)
+{
+    if (!Pattern)
+        return true;
+
+    return !fnmatch(Pattern, String, FNM_CASEFOLD);
+}
+
+static bool TargetMatch(TARGET_FILTER *Filter, TARGET *Target)
+{
+    if (!TargetMatchString(Filter->Name, Target->Name))
+        return false;
+
+    if (Filter->MinSize && Target->Size < Filter->MinSize)
+        return false;
+
+    if (Filter->MaxSize && Target->Size > Filter->MaxSize)
+        return false;
+
+    if (!TargetMatchString(Filter->Transport, Target->Transport))
+        return false;
+
+    if (!TargetMatchString(Filter->Vendor, Target->Vendor))
+        return false;
+
+    if (!TargetMatchString(Filter->Model, Target->Model))
+        return false;
+
+    if (!TargetMatchString(Filter->Serial, Target->Serial))
+        return false;
+
+    if (Filter->Removable != -1 && Filter->Removable != Target->Removable)
+        return false;
+
+    return true;
+}
+
+static void TargetFindSystemDisks(void)
+{
+    struct stat statbuf;
+    char Line[4096], Source[PATH_MAX];
+
+    if (stat(TARGET_ROOT_PATH, &statbuf) == -1)
+        return;
+
+    Target_SystemDiskCount = GetBlockDisks(statbuf.st_dev, Target_SystemDisks, TARGET_MAX_SYSTEM_DISKS);
+
+    if (Target_SystemDiskCount)
+        return;
+
+    /* Btrfs and other multi device file systems report an anonymous device, the mount source names the real one */
+    FILE *MountInfo = fopen(TARGET_MOUNTINFO_FILE, "r");
+    if (!MountInfo)
+        return;
+
+    while (fgets(Line, sizeof(Line), MountInfo))
+    {
+        char *Separator = strstr(Line, " - ");
+        char MountPoint[PATH_MAX];
+
+        if (!Separator || sscanf(Line, "%*s %*s %*s %*s %s", MountPoint) != 1 ||
+            strcmp(MountPoint, TARGET_ROOT_PATH) || sscanf(Separator, " - %*s %s", Source) != 1)
+            continue;
+
+        if (!stat(Source, &statbuf) && S_ISBLK(statbuf.st_mode))
+            Target_SystemDiskCount = GetBlockDisks(statbuf.st_rdev, Target_SystemDisks, TARGET_MAX_SYSTEM_DISKS);
+    }
+
+    fclose(MountInfo);
+}
+
+static bool TargetIsExcluded(char *Name)
+{
+    char Buffer[32];
+    unsigned int Major, Minor;
+
+    for (size_t i = 0; i < sizeof(Target_VirtualPrefixes) / sizeof(char *); i++)
+    {
+        if (!strncmp(Name, Target_VirtualPrefixes[i], strlen(Target_VirtualPrefixes[i])))
+            return true;
+    }
+
+    pthread_once(&Target_SystemDisksOnce, TargetFindSystemDisks);
+
+    if (!TargetReadAttribute(Name, "dev", Buffer, sizeof(Buffer)) || sscanf(Buffer, "%u:%u", &Major, &Minor) != 2)
+        return false;
+
+    for (size_t i = 0; i < Target_SystemDiskCount; i++)
+    {
+        if (Target_SystemDisks[i] == makedev(Major, Minor))
+            return true;
+    }
+
+    return false;
+}
+
+bool TargetProbeName(TARGET_FILTER *Filter, uint8_t PartitionNumber, TARGET *Target)
+{
+    char Buffer[PATH_MAX];
+
+    /* The disk holding the running system can never be selected, whatever the filter says */
+    Target->Excluded = TargetIsExcluded(Target->Name);
+
+    if (Target->Excluded)
+        return false;
+
+    snprintf(Target->Device, sizeof(Target->Device), TARGET_DEVICE_PATH "/%s", Target->Name);
+
+    int64_t Size = GetFileSize(Target->Device);
+
+    /* Fall back to sysfs when the node is missing or not accessible */
+    if (Size == -1 && TargetReadAttribute(Target->Name, "size", Buffer, sizeof(Buffer)))
+        Size = (int64_t)strtoull(Buffer, NULL, 10) * SECTOR_SIZE;
+
+    if (Size <= 0)
+        return false;
+
+    Target->Size = (uint64_t)Size;
+
+    snprintf(Buffer, sizeof(Buffer), TARGET_SYSFS_BLOCK_PATH "/%s", Target->Name);
+
+    char *DevicePath = realpath(Buffer, NULL);
+    if (DevicePath)
+    {
+        for (size_t i = 0; i < sizeof(Target_Transports) / sizeof(TARGET_TRANSPORT); i++)
+        {
+            if (strstr(DevicePath, Target_Transports[i].PathComponent))
+            {
+                strncpy(Target->Transport, Target_Transports[i].Transport, sizeof(Target->Transport) - 1);
+                break;
+            }
+        }
+
+        free(DevicePath);
+    }
+
+    TargetReadAttribute(Target->Name, "device/vendor", Target->Vendor, sizeof(Target->Vendor));
+
+    if (!TargetReadAttribute(Target->Name, "device/model", Target->Model, sizeof(Target->Model)))
+        TargetReadAttribute(Target->Name, "device/name", Target->Model, sizeof(Target->Model));
+
+    TargetReadSerial(Target->Name, Target->Serial, sizeof(Target->Serial));
+
+    if (TargetReadAttribute(Target->Name, "removable", Buffer, sizeof(Buffer)))
+        Target->Removable = atoi(Buffer) != 0;
+
+    Target->Matched = TargetMatch(Filter, Target);
+
+    if (Target->Matched)
+        TargetPartitionDevice(Target->Name, PartitionNumber,
+                              Target->PartitionDevice, sizeof(Target->PartitionDevice));
+
+    return Target->Matched;
+}
+
+static void TargetProbe(size_t Index, void *Context)
+{
+    TARGET_DISCOVERY *Discovery = Context;
+
+    TargetProbeName(Discovery->Filter, Discovery->PartitionNumber, &Discovery->Targets[Index]);
+}
+
+bool TargetParseFilter(char *String, TARGET_FILTER *Filter)
+{
+    char *SavePointer;
+
+    memset(Filter, 0, sizeof(TARGET_FILTER));
+    Filter->Removable = -1;
+
+    for (char *Token = strtok_r(String, ",", &SavePointer); Token; Token = strtok_r(NULL, ",", &SavePointer))
+    {
+        char *Value = strchr(Token, '=');
+
+        if (!Value)
+        {
+            printf(DEBUG_STRING STR_000016, Token);
+            return false;
+        }
+
+        *Value++ = '\0';
+
+        if (!strcasecmp(Token, TARGET_FILTER_NAME_STRING))
+            Filter->Name = Value;
+        else if (!strcasecmp(Token, TARGET_FILTER_MINSIZE_STRING) ||
+                 !strcasecmp(Token, TARGET_FILTER_MAXSIZE_STRING))
+        {
+            bool Minimum = !strcasecmp(Token, TARGET_FILTER_MINSIZE_STRING);
+
+            if (!TargetParseSize(Value, Minimum ? &Filter->MinSize : &Filter->MaxSize))
+            {
+                printf(DEBUG_STRING STR_000081, Token, Value);
+                return false;
+            }
+        }
+        else if (!strcasecmp(Token, TARGET_FILTER_TRANSPORT_STRING))
+            Filter->Transport = Value;
+        else if (!strcasecmp(Token, TARGET_FILTER_VENDOR_STRING))
+            Filter->Vendor = Value;
+        else if (!strcasecmp(Token, TARGET_FILTER_MODEL_STRING))
+            Filter->Model = Value;
+        else if (!strcasecmp(Token, TARGET_FILTER_SERIAL_STRING))
+            Filter->Serial = Value;
+        else if (!strcasecmp(Token, TARGET_FILTER_REMOVABLE_STRING))
+        {
+            char *End;
+            unsigned long Removable = strtoul(Value, &End, 10);
+
+            /* Anything else would silently select the fixed disks */
+            if (!isdigit((unsigned char)*Value) || *End || Removable > 1)
+            {
+                printf(DEBUG_STRING STR_000095, Token, Value);
+                return false;
+            }
+
+            Filter->Removable = (int8_t)Removable;
+        }
+        else
+        {
+            printf(DEBUG_STRING STR_000016, Token);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TargetPartitionDevice(char *Name, uint8_t PartitionNumber, char *Device, size_t DeviceSize)
+{
+    char Path[PATH_MAX], Buffer[16];
+    bool Found = false;
+
+    snprintf(Path, sizeof(Path), TARGET_SYSFS_BLOCK_PATH "/%s", Name);
+
+    DIR *Directory = opendir(Path);
+    if (Directory)
+    {
+        struct dirent *Entry;
+        size_t NameLength = strlen(Name);
+
+        while (!Found && (Entry = readdir(Directory)))
+        {
+            if (strncmp(Entry->d_name, Name, NameLength))
+                continue;
+
+            char Attribute[sizeof(Entry->d_name) + sizeof("/partition")];
+
+            snprintf(Attribute, sizeof(Attribute), "%s/partition", Entry->d_name);
+
+            if (TargetReadAttribute(Name, Attribute, Buffer, sizeof(Buffer)) &&
+                atoi(Buffer) == PartitionNumber)
+            {
+                snprintf(Device, DeviceSize, TARGET_DEVICE_PATH "/%s", Entry->d_name);
+                Found = true;
+            }
+        }
+
+        closedir(Directory);
+    }
+
+    if (Found)
+        return true;
+
+    /* The kernel inserts a 'p' when the disk name already ends with a digit */
+    size_t Length = strlen(Name);
+    bool NeedsSeparator = Length && Name[Length - 1] >= '0' && Name[Length - 1] <= '9';
+
+    snprintf(Device, DeviceSize, TARGET_DEVICE_PATH "/%s%s%u", Name, NeedsSeparator ? "p" : "", PartitionNumber);
+
+    return false;
+}
+
+size_t TargetDiscover(TARGET_FILTER *Filter, uint8_t PartitionNumber, TARGET **Targets)
+{
+    DIR *Directory = opendir(TARGET_SYSFS_BLOCK_PATH);
+    if (!Directory)
+    {
+        printf(DEBUG_STRING STR_000002, TARGET_SYSFS_BLOCK_PATH);
+        *Targets = NULL;
+        return 0;
+    }
+
+    TARGET *Candidates = NULL;
+    size_t Count = 0, Capacity = 0;
+    struct dirent *Entry;
+
+    while ((Entry = readdir(Directory)))
+    {
+        if (Entry->d_name[0] == '.' || strlen(Entry->d_name) >= TARGET_NAME_SIZE)
+            continue;
+
+        if (Count == Capacity)
+        {
+            Capacity = Capacity ? Capacity * 2 : 32;
+
+            TARGET *Resized = realloc(Candidates, Capacity * sizeof(TARGET));
+            if (!Resized)
+            {
+                printf(DEBUG_STRING STR_000004);
+                closedir(Directory);
+                free(Candidates);
+                *Targets = NULL;
+                return 0;
+            }
+
+            Candidates = Resized;
+        }
+
+        memset(&Candidates[Count], 0, sizeof(TARGET));
+        strcpy(Candidates[Count].Name, Entry->d_name);
+        Count++;
+    }
+
+    closedir(Directory);
+
+    TARGET_DISCOVERY Discovery = {
+        .Filter = Filter,
+        .Targets = Candidates,
+        .PartitionNumber = PartitionNumber,
+    };
+
+    ParallelFor(Count, 0, TargetProbe, &Discovery);
+
+    size_t Matched = 0;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        if (Candidates[i].Matched)
+            Candidates[Matched++] = Candidates[i];
+    }
+
+    if (!Matched)
+    {
+        free(Candidates);
+        Candidates = NULL;
+    }
+
+    *Targets = Candidates;
+    return Matched;
+}
+
+typedef struct _TARGET_RUN
+{
+    TARGET *Targets;
+    TARGET_ROUTINE Routine;
+} TARGET_RUN;
+
+static void TargetRun(size_t Index, void *Context)
+{
+    TARGET_RUN *Run = Context;
+    TARGET *Target = &Run->Targets[Index];
+
+    Target->Result = Run->Routine(Target);
+}
+
+bool TargetRunAll(TARGET *Targets, size_t Count, TARGET_ROUTINE Routine)
+{
+    TARGET_RUN Run = {
+        .Targets = Targets,
+        .Routine = Routine,
+    };
+    bool Result = true;
+
+    ParallelFor(Count, 0, TargetRun, &Run);
+
+    for (size_t i = 0; i < Count; i++)
+        Result &= Targets[i].Result;
+
+    return Result;
+}
+
+/* Only told after the durability barrier, a drive that failed to flush is not OK */
+bool TargetReport(TARGET *Targets, size_t Count)
+{
+    bool Result = true;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        if (SyncFailed(Targets[i].Device))
+            Targets[i].Result = false;
+
+        printf(STR_000017, Targets[i].Device, Targets[i].Result ? STR_000018 : STR_000019);
+        Result &= Targets[i].Result;
+    }
+
+    return Result;
+}
+
+/* The serial of the disk a node belongs to, empty for image files and disks that report none */
+void TargetDeviceSerial(char *Device, char *Serial, size_t SerialSize)
+{
+    char Link[PATH_MAX], Path[PATH_MAX];
+    struct stat statbuf;
+    dev_t Disk;
+
+    Serial[0] = '\0';
+
+    if (stat(Device, &statbuf) == -1 || !S_ISBLK(statbuf.st_mode))
+        return;
+
+    if (GetBlockDisks(statbuf.st_rdev, &Disk, 1) != 1)
+        Disk = statbuf.st_rdev;
+
+    snprintf(Link, sizeof(Link), SYSFS_DEV_BLOCK_PATH "/%u:%u", major(Disk), minor(Disk));
+
+    ssize_t Length = readlink(Link, Path, sizeof(Path) - 1);
+    if (Length <= 0)
+        return;
+
+    Path[Length] = '\0';
+
+    char *Name = strrchr(Path, '/');
+
+    TargetReadSerial(Name ? Name + 1 : Path, Serial, SerialSize);
+}
+
+void TargetPrint(TARGET *Target)
+{
+    printf(STR_000020, Target->Device, (unsigned long long)Target->Size,
+           Target->Transport[0] ? Target->Transport : "-",
+           Target->Vendor[0] ? Target->Vendor : "-",
+           Target->Model[0] ? Target->Model : "-",
+           Target->Serial[0] ? Target->Serial : "-",
+           Target->Removable);
+}
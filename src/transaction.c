@@ -0,0 +1,334 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to flash MBR&VBR through a single disk handle
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <transaction.h>
+#include <patch.h>
+#include <sync.h>
+#include <stage2.h>
+#include <plan.h>
+#include <sweep.h>
+#include <online.h>
+#include <sys/sysmacros.h>
+
+bool TransactionMode;
+bool TransactionVerify;
+
+static bool TransactionRead(int Descriptor, void *Buffer, size_t Size, uint64_t Offset)
+{
+    size_t Done = 0;
+
+    while (Done < Size)
+    {
+        ssize_t Count = pread(Descriptor, (uint8_t *)Buffer + Done, Size - Done, (off_t)(Offset + Done));
+
+        if (Count < 0)
+            return false;
+
+        /* Past the end of the disk, the rest of the buffer stays zeroed */
+        if (Count == 0)
+            break;
+
+        Done += (size_t)Count;
+    }
+
+    return Done >= SECTOR_SIZE;
+}
+
+static bool TransactionPrepareVbr(int Descriptor, char *VBRFile, VBR_INSTALLER *VBR_Installer,
+                                  uint8_t PartitionNumber, TRANSACTION *Transaction)
+{
+    MBR_PTE *PTE = &Transaction->Dest.PTE[PartitionNumber];
+    uint64_t PartitionStartSector = PTE->LBAStartAddress;
+    uint64_t PartitionEndSector = PartitionStartSector + PTE->PartitionSectors;
+
+    /* An empty slot starts at LBA 0, the VBR would land over the partition table */
+    if (!PTE->PartitionType || !PTE->LBAStartAddress || !PTE->PartitionSectors)
+    {
+        printf(DEBUG_STRING STR_000085, PartitionNumber + 1);
+        return false;
+    }
+
+    Transaction->DestVBR[PartitionNumber] = calloc(1, VBR_SIZE_LIMIT);
+    Transaction->SrcVBR[PartitionNumber] = VbrReadFile(VBRFile, VBR_SIZE_LIMIT, VBR_Installer->VBRSize);
+
+    void *DestVBR = Transaction->DestVBR[PartitionNumber];
+    void *SrcVBR = Transaction->SrcVBR[PartitionNumber];
+
+    if (!DestVBR || !SrcVBR ||
+        !TransactionRead(Descriptor, DestVBR, VBR_SIZE_LIMIT, PartitionStartSector * SECTOR_SIZE))
+    {
+        printf(DEBUG_STRING STR_000007);
+        return false;
+    }
+
+    uint8_t Previous[VBR_SIZE_LIMIT];
+
+    memcpy(Previous, DestVBR, VBR_Installer->VBRSize);
+
+    if (!VBR_Installer->Install(PartitionNumber + 1,
+                                &PartitionStartSector, &PartitionEndSector,
+                                DestVBR, SrcVBR, &Transaction->Backups))
+    {
+        printf(DEBUG_STRING STR_000011);
+        return false;
+    }
+
+    if (Stage2Location == Stage2LocationReserved &&
+        (!Stage2PlaceFatReserved(Descriptor, PartitionStartSector * SECTOR_SIZE, VBR_Installer->VBRSize,
+                                 Previous, DestVBR, &Transaction->Stage2) ||
+         !PatchListAdd(&Transaction->Patches, Transaction->Stage2.Offset,
+                       Transaction->Stage2.Buffer, Transaction->Stage2.Size)))
+        return false;
+
+    /* The backups are queued relative to the partition, they are moved to it and cleared for the next one */
+    bool Result = PatchListAdd(&Transaction->Patches, PartitionStartSector * SECTOR_SIZE,
+                               DestVBR, VBR_Installer->VBRSize) &&
+                  PatchListAppend(&Transaction->Patches, &Transaction->Backups, PartitionStartSector * SECTOR_SIZE);
+
+    PatchListFree(&Transaction->Backups);
+    return Result;
+}
+
+static bool TransactionPrepareSweep(int Descriptor, TRANSACTION *Transaction)
+{
+    size_t Swept = 0;
+
+    for (uint8_t i = 0; i < TRANSACTION_MAX_VBRS; i++)
+    {
+        MBR_PTE *PTE = &Transaction->Dest.PTE[i];
+        uint16_t VBRSize;
+
+        if (!PTE->PartitionType || !PTE->LBAStartAddress)
+            continue;
+
+        VBR_INSTALLER *VBR_Installer = VbrDetectFileSystem(Descriptor, (uint64_t)PTE->LBAStartAddress * SECTOR_SIZE,
+                                                           &VBRSize);
+        SWEEP_RULE *Rule = VBR_Installer ? SweepFindRule(VBR_Installer, VBRSize) : NULL;
+
+        if (!Rule)
+        {
+            printf(DEBUG_STRING STR_000077, i + 1);
+            continue;
+        }
+
+        printf(DEBUG_STRING STR_000076, i + 1, Rule->FileSystem, Rule->File);
+
+        if (!TransactionPrepareVbr(Descriptor, Rule->File, VBR_Installer, i, Transaction))
+            return false;
+
+        Swept++;
+    }
+
+    if (!Swept)
+    {
+        printf(DEBUG_STRING STR_000078);
+        return false;
+    }
+
+    return true;
+}
+
+static bool TransactionPrepare(int Descriptor, char *MBRFile,
+                               char *VBRFile, char *FileSystem,
+                               uint8_t PartitionNumber, TRANSACTION *Transaction)
+{
+    if (!TransactionRead(Descriptor, &Transaction->Dest, MBR_SIZE, 0))
+    {
+        printf(DEBUG_STRING STR_000007);
+        return false;
+    }
+
+    if (MBRFile)
+    {
+        MBR Previous = Transaction->Dest;
+
+        Transaction->Src = MbrReadFile(MBRFile);
+
+        if (!Transaction->Src || !MbrInstall(&Transaction->Dest, Transaction->Src))
+        {
+            printf(DEBUG_STRING STR_000010);
+            return false;
+        }
+
+        /* The stage 2 is queued first, so it lands before the boot code that points to it */
+        if (Stage2Location == Stage2LocationMbrGap &&
+            (!Stage2PlaceMbrGap(Descriptor, &Previous, &Transaction->Dest, &Transaction->Stage2) ||
+             !PatchListAdd(&Transaction->Patches, Transaction->Stage2.Offset,
+                           Transaction->Stage2.Buffer, Transaction->Stage2.Size)))
+            return false;
+
+        if (!PatchListAdd(&Transaction->Patches, 0, &Transaction->Dest, MBR_SIZE))
+            return false;
+    }
+
+    if (VBRFile)
+    {
+        VBR_INSTALLER *VBR_Installer = FileSystem ? VbrFindInstaller(FileSystem) : NULL;
+
+        if (!VBR_Installer)
+        {
+            printf(DEBUG_STRING STR_000012);
+            return false;
+        }
+
+        return TransactionPrepareVbr(Descriptor, VBRFile, VBR_Installer, PartitionNumber, Transaction);
+    }
+
+    /* Every partition gets the VBR file its file system maps to, all through the same handle */
+    if (SweepMode)
+        return TransactionPrepareSweep(Descriptor, Transaction);
+
+    return true;
+}
+
+static void TransactionFree(TRANSACTION *Transaction)
+{
+    PatchListFree(&Transaction->Patches);
+    PatchListFree(&Transaction->Backups);
+    Stage2Free(&Transaction->Stage2);
+    free(Transaction->Src);
+
+    for (size_t i = 0; i < TRANSACTION_MAX_VBRS; i++)
+    {
+        free(Transaction->DestVBR[i]);
+        free(Transaction->SrcVBR[i]);
+    }
+}
+
+/* The VBR is reached through the partition table of the disk, the -VBR device may only name that same partition */
+bool TransactionCheckDevice(char *Device, char *VbrDevice, uint8_t PartitionNumber)
+{
+    struct stat Disk, Partition;
+    unsigned int Number = 0;
+    char Path[PATH_MAX];
+    dev_t Parent;
+
+    if (stat(Device, &Disk) == -1 || stat(VbrDevice, &Partition) == -1)
+    {
+        printf(DEBUG_STRING STR_000086, VbrDevice, PartitionNumber + 1, Device);
+        return false;
+    }
+
+    /* Naming the disk or the image itself is fine, the partition is taken from its table */
+    if ((Disk.st_dev == Partition.st_dev && Disk.st_ino == Partition.st_ino) ||
+        (S_ISBLK(Disk.st_mode) && S_ISBLK(Partition.st_mode) && Disk.st_rdev == Partition.st_rdev))
+        return true;
+
+    if (S_ISBLK(Disk.st_mode) && S_ISBLK(Partition.st_mode) &&
+        GetBlockDisks(Partition.st_rdev, &Parent, 1) == 1 && Parent == Disk.st_rdev)
+    {
+        snprintf(Path, sizeof(Path), SYSFS_DEV_BLOCK_PATH "/%u:%u/partition",
+                 major(Partition.st_rdev), minor(Partition.st_rdev));
+
+        FILE *File = fopen(Path, "r");
+
+        if (File)
+        {
+            if (fscanf(File, "%u", &Number) != 1)
+                Number = 0;
+
+            fclose(File);
+        }
+
+        if (Number == PartitionNumber + 1u)
+            return true;
+    }
+
+    printf(DEBUG_STRING STR_000086, VbrDevice, PartitionNumber + 1, Device);
+    return false;
+}
+
+/* A dry run against the image the drive is about to receive, a bad payload is caught before anything is written */
+bool TransactionCheck(char *Image, char *MBRFile,
+                      char *VBRFile, char *FileSystem,
+                      uint8_t PartitionNumber)
+{
+    TRANSACTION Transaction = {0};
+
+    int Descriptor = open(Image, O_RDONLY);
+    if (Descriptor == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Image);
+        return false;
+    }
+
+    bool Result = TransactionPrepare(Descriptor, MBRFile, VBRFile, FileSystem, PartitionNumber, &Transaction);
+
+    TransactionFree(&Transaction);
+    close(Descriptor);
+    return Result;
+}
+
+bool TransactionFlash(char *Device, char *MBRFile,
+                      char *VBRFile, char *FileSystem,
+                      uint8_t PartitionNumber)
+{
+    TRANSACTION Transaction = {0};
+    bool Result = false;
+
+    if (!Device)
+    {
+        printf(DEBUG_STRING STR_000006);
+        return false;
+    }
+
+    /* Opened once for reading and writing, so udev only sees a single close */
+    int Descriptor = open(Device, PlanFile ? O_RDONLY : O_RDWR);
+    if (Descriptor == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Device);
+        return false;
+    }
+
+    if (!TransactionPrepare(Descriptor, MBRFile, VBRFile, FileSystem, PartitionNumber, &Transaction))
+        goto Exit;
+
+    /*
+     * The disk node does not share the page cache of a mounted partition, the
+     * kernel could write its stale copy of the boot block back over ours
+     */
+    for (uint8_t i = 0; i < TRANSACTION_MAX_VBRS; i++)
+    {
+        if (Transaction.DestVBR[i] && OnlineIsPartitionMounted(Device, Transaction.Dest.PTE[i].LBAStartAddress))
+        {
+            printf(DEBUG_STRING STR_000082, i + 1, Device);
+            goto Exit;
+        }
+    }
+
+    /* When planning, the patches are recorded instead of written */
+    if (PlanFile)
+    {
+        Result = PlanRecord(Device, Descriptor, &Transaction.Patches);
+        goto Exit;
+    }
+
+    if (!PatchListWrite(Descriptor, &Transaction.Patches))
+    {
+        printf(DEBUG_STRING STR_000025, Device);
+        goto Exit;
+    }
+
+    if (!SyncHandle(Descriptor))
+    {
+        printf(DEBUG_STRING STR_000024);
+        goto Exit;
+    }
+
+    if (TransactionVerify && !PatchListVerify(Descriptor, &Transaction.Patches))
+    {
+        printf(DEBUG_STRING STR_000065, Device);
+        goto Exit;
+    }
+
+    Result = true;
+
+Exit:
+    TransactionFree(&Transaction);
+    close(Descriptor);
+    return Result;
+}
@@ -6,44 +6,109 @@
  */
 
 #include <vbr.h>
+#include <sync.h>
+#include <stage2.h>
+#include <online.h>
 
 bool BtrfsInstall(uint8_t PartitionNumber,
                   uint64_t *PartitionStartSector, uint64_t *PartitionEndSector,
-                  void *Dest, void *Src);
+                  void *Dest, void *Src, PATCH_LIST *Backups);
 bool ExtInstall(uint8_t PartitionNumber,
                 uint64_t *PartitionStartSector, uint64_t *PartitionEndSector,
-                void *Dest, void *Src);
+                void *Dest, void *Src, PATCH_LIST *Backups);
 bool FatInstall(uint8_t PartitionNumber,
                 uint64_t *PartitionStartSector, uint64_t *PartitionEndSector,
-                void *Dest, void *Src);
+                void *Dest, void *Src, PATCH_LIST *Backups);
 bool NtfsInstall(uint8_t PartitionNumber,
                  uint64_t *PartitionStartSector, uint64_t *PartitionEndSector,
-                 void *Dest, void *Src);
+                 void *Dest, void *Src, PATCH_LIST *Backups);
+
+size_t BtrfsBootCodeRanges(void *Dest, const VBR_RANGE **Ranges);
+size_t ExtBootCodeRanges(void *Dest, const VBR_RANGE **Ranges);
+size_t FatBootCodeRanges(void *Dest, const VBR_RANGE **Ranges);
+size_t NtfsBootCodeRanges(void *Dest, const VBR_RANGE **Ranges);
 
 VBR_INSTALLER VBR_Installers[] = {
     {
         .VBRSize = VBR_FILESYSTEM_BTRFS_SIZE,
         .FileSystem = VBR_FILESYSTEM_BTRFS_STRING,
         .Install = BtrfsInstall,
+        .BootCodeRanges = BtrfsBootCodeRanges,
     },
     {
         .VBRSize = VBR_FILESYSTEM_EXT_SIZE,
         .FileSystem = VBR_FILESYSTEM_EXT_STRING,
         .Install = ExtInstall,
+        .BootCodeRanges = ExtBootCodeRanges,
     },
     {
         .VBRSize = VBR_FILESYSTEM_FAT_SIZE,
         .FileSystem = VBR_FILESYSTEM_FAT_STRING,
         .Install = FatInstall,
+        .BootCodeRanges = FatBootCodeRanges,
     },
     {
         .VBRSize = VBR_FILESYSTEM_NTFS_SIZE,
         .FileSystem = VBR_FILESYSTEM_NTFS_STRING,
         .Install = NtfsInstall,
+        .BootCodeRanges = NtfsBootCodeRanges,
     },
 };
 
-void *VbrReadFile(char *File, uint16_t FileSize)
+VBR_INSTALLER *VbrFindInstaller(char *FileSystem)
+{
+    for (size_t i = 0; i < sizeof(VBR_Installers) / sizeof(VBR_INSTALLER); i++)
+    {
+        if (!strcasecmp(VBR_Installers[i].FileSystem, FileSystem))
+            return &VBR_Installers[i];
+    }
+
+    return NULL;
+}
+
+VBR_INSTALLER *VbrDetectFileSystem(int Descriptor, uint64_t Offset, uint16_t *VBRSize)
+{
+    uint8_t Buffer[VBR_FILESYSTEM_EXT_SIZE];
+    char *FileSystem = NULL;
+
+    if (pread(Descriptor, Buffer, sizeof(Buffer), (off_t)Offset) != sizeof(Buffer))
+        return NULL;
+
+    NTFS_VBR *NtfsVBR = (NTFS_VBR *)Buffer;
+    FAT16_VBR *Fat16VBR = (FAT16_VBR *)Buffer;
+    EXT_VBR *ExtVBR = (EXT_VBR *)Buffer;
+
+    if (!memcmp(NtfsVBR->OemId, VBR_FILESYSTEM_OEM_NTFS_STRING, sizeof(NtfsVBR->OemId)))
+        FileSystem = VBR_FILESYSTEM_NTFS_STRING;
+    else if (IsFat32(Buffer) ||
+             !strncasecmp((char *)Fat16VBR->FileSystemType, VBR_FILESYSTEM_TYPE_FAT_STRING,
+                          strlen(VBR_FILESYSTEM_TYPE_FAT_STRING)))
+        FileSystem = VBR_FILESYSTEM_FAT_STRING;
+    else if (ExtVBR->Magic == VBR_FILESYSTEM_SIGNATURE_EXT)
+        FileSystem = VBR_FILESYSTEM_EXT_STRING;
+    else
+    {
+        /* The BTRFS superblock lives past the VBR, at the 64KiB mark */
+        char Signature[sizeof(VBR_FILESYSTEM_SIGNATURE_BTRFS) - 1];
+
+        if (pread(Descriptor, Signature, sizeof(Signature),
+                  (off_t)(Offset + VBR_FILESYSTEM_SIGNATURE_BTRFS_OFFSET)) == sizeof(Signature) &&
+            !memcmp(Signature, VBR_FILESYSTEM_SIGNATURE_BTRFS, sizeof(Signature)))
+            FileSystem = VBR_FILESYSTEM_BTRFS_STRING;
+    }
+
+    if (!FileSystem)
+        return NULL;
+
+    VBR_INSTALLER *VBR_Installer = VbrFindInstaller(FileSystem);
+
+    if (VBRSize)
+        *VBRSize = IsFat32(Buffer) ? VBR_FILESYSTEM_FAT32_SIZE : VBR_Installer->VBRSize;
+
+    return VBR_Installer;
+}
+
+void *VbrReadFile(char *File, uint16_t BufferSize, uint16_t FileSize)
 {
     if (!File)
     {
@@ -51,6 +116,20 @@ void *VbrReadFile(char *File, uint16_t FileSize)
         return NULL;
     }
 
+    if (IsStreamFile(File))
+    {
+        void *Buffer = calloc(1, BufferSize);
+
+        if (!Buffer || !StreamRead(StreamSectionVbr, Buffer, FileSize))
+        {
+            printf(DEBUG_STRING STR_000004);
+            free(Buffer);
+            return NULL;
+        }
+
+        return Buffer;
+    }
+
     FILE *Bin = fopen(File, "rb");
     if (!Bin)
     {
@@ -66,7 +145,7 @@ void *VbrReadFile(char *File, uint16_t FileSize)
         return false;
     }
 
-    void *Buffer = malloc(FileSize);
+    void *Buffer = malloc(BufferSize);
 
     if (!Buffer)
     {
@@ -75,7 +154,7 @@ void *VbrReadFile(char *File, uint16_t FileSize)
         return NULL;
     }
 
-    memset(Buffer, 0, FileSize);
+    memset(Buffer, 0, BufferSize);
 
     size = size > FileSize ? FileSize : size;
 
@@ -108,14 +187,14 @@ bool VbrWriteFile(char *File, void *Buffer, uint16_t FileSize)
         return false;
     }
 
-    FILE *Bin = fopen(File, "wb");
+    FILE *Bin = OpenFile(File, "wb");
     if (!Bin)
     {
         printf(DEBUG_STRING STR_000002, File);
         return false;
     }
 
-    int64_t size = GetFileSize(File);
+    int64_t size = IsStreamFile(File) ? FileSize : GetFileSize(File);
 
     if (!size)
         size = FileSize;
@@ -123,7 +202,7 @@ bool VbrWriteFile(char *File, void *Buffer, uint16_t FileSize)
     if (size == -1)
     {
         printf(DEBUG_STRING STR_000004);
-        fclose(Bin);
+        CloseFile(Bin);
         return false;
     }
 
@@ -134,22 +213,77 @@ bool VbrWriteFile(char *File, void *Buffer, uint16_t FileSize)
     if (count < (size_t)size)
     {
         printf(DEBUG_STRING STR_000011);
-        fclose(Bin);
+        CloseFile(Bin);
         return false;
     }
 
-    fclose(Bin);
+    if (!SyncFile(Bin))
+    {
+        printf(DEBUG_STRING STR_000024);
+        CloseFile(Bin);
+        return false;
+    }
+
+    CloseFile(Bin);
 
     return true;
 }
 
+static bool VbrWritePatches(char *Device, PATCH_LIST *Patches, bool Online)
+{
+    bool Result = false;
+
+    int Descriptor = open(Device, O_WRONLY);
+    if (Descriptor == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Device);
+        return false;
+    }
+
+    if (!PatchListWrite(Descriptor, Patches))
+    {
+        printf(DEBUG_STRING STR_000025, Device);
+        goto Exit;
+    }
+
+    /* A mounted volume shares this page cache with the kernel, the flush keeps both coherent on disk */
+    if (!(Online ? SyncHandleForced(Descriptor) : SyncHandle(Descriptor)))
+    {
+        printf(DEBUG_STRING STR_000024);
+        goto Exit;
+    }
+
+    Result = true;
+
+Exit:
+    close(Descriptor);
+    return Result;
+}
+
 bool VbrFlash(char *Device, char *File, char *FileSystem,
               uint8_t PartitionNumber,
               uint64_t *PartitionStartSector, uint64_t *PartitionEndSector)
 {
-    uint16_t VBRSize = VBR_SIZE_LIMIT;
     bool Result = false;
-    void *Dest = VbrReadFile(Device, VBRSize), *Src = VbrReadFile(File, VBRSize);
+    PATCH_LIST Patches = {0}, Backups = {0};
+    VBR_INSTALLER *VBR_Installer = FileSystem ? VbrFindInstaller(FileSystem) : NULL;
+
+    if (!VBR_Installer)
+    {
+        printf(DEBUG_STRING STR_000012);
+        return Result;
+    }
+
+    /* A mounted volume only gets its boot code bytes, the superblock and the BPB stay with the kernel */
+    bool Online = !InvertedFlashDirection && Device && (OnlineMode || OnlineIsMounted(Device));
+
+    if (Online && !OnlineMode)
+        printf(DEBUG_STRING STR_000045, Device);
+
+    /* Buffers keep the size limit, the payload itself is sized by the file system */
+    uint16_t VBRSize = VBR_Installer->VBRSize;
+    void *Dest = VbrReadFile(Device, VBR_SIZE_LIMIT, VBR_SIZE_LIMIT);
+    void *Src = InvertedFlashDirection ? NULL : VbrReadFile(File, VBR_SIZE_LIMIT, VBRSize);
 
     if (!Dest || (!Src && !InvertedFlashDirection))
     {
@@ -159,41 +293,43 @@ bool VbrFlash(char *Device, char *File, char *FileSystem,
         return Result;
     }
 
-    if (!FileSystem)
-        goto ErrInvalidFS;
+    uint8_t Previous[VBR_SIZE_LIMIT];
 
-    for (size_t i = 0; i < sizeof(VBR_Installers) / sizeof(VBR_INSTALLER); i++)
-    {
-        VBR_INSTALLER *VBR_Installer = &VBR_Installers[i];
+    memcpy(Previous, Dest, VBRSize);
 
-        if (!strcasecmp(VBR_Installer->FileSystem, FileSystem))
-        {
-            VBRSize = VBR_Installer->VBRSize;
+    /* Without the partition table the partition node itself bounds the backup sectors */
+    uint64_t StartSector = *PartitionStartSector, EndSector = *PartitionEndSector;
+    int64_t DeviceSize = EndSector > StartSector ? -1 : GetFileSize(Device);
 
-            if (InvertedFlashDirection)
-            {
-                Result = true;
-                break;
-            }
+    if (DeviceSize > 0)
+        EndSector = StartSector + (uint64_t)DeviceSize / SECTOR_SIZE;
 
-            if (VBR_Installer->Install)
-                Result = VBR_Installer->Install(PartitionNumber + 1,
-                                                PartitionStartSector, PartitionEndSector,
-                                                Dest, Src);
+    if (InvertedFlashDirection)
+        Result = true;
+    else if (VBR_Installer->Install)
+        Result = VBR_Installer->Install(PartitionNumber + 1,
+                                        &StartSector, &EndSector,
+                                        Dest, Src, &Backups);
 
-            break;
-        }
+    if (Result && !InvertedFlashDirection && Stage2Location == Stage2LocationReserved)
+        Result = Stage2Install(Device, Stage2LocationReserved, VBRSize, Previous, Dest);
+
+    /* The backup boot sectors are written along with the primary through the same handle */
+    if (Result && !InvertedFlashDirection)
+    {
+        if (Online)
+            Result = OnlinePatches(VBR_Installer, Previous, Dest, VBRSize, &Backups, &Patches);
+        else
+            Result = PatchListAdd(&Patches, 0, Dest, VBRSize) &&
+                     PatchListAppend(&Patches, &Backups, 0);
     }
 
     if (Result)
-        VbrWriteFile(InvertedFlashDirection ? File : Device, Dest, VBRSize);
+        Result = InvertedFlashDirection ? VbrWriteFile(File, Dest, VBRSize)
+                                        : VbrWritePatches(Device, &Patches, Online);
 
-    free(Dest);
-    free(Src);
-    return Result;
-
-ErrInvalidFS:
-    printf(DEBUG_STRING STR_000012);
+    PatchListFree(&Patches);
+    PatchListFree(&Backups);
     free(Dest);
     free(Src);
     return Result;
@@ -234,7 +370,7 @@ bool IsExt3Plus(void *Buffer)
 
 bool BtrfsInstall(uint8_t PartitionNumber,
                   uint64_t *PartitionStartSector, uint64_t *PartitionEndSector,
-                  void *Dest, void *Src)
+                  void *Dest, void *Src, PATCH_LIST *Backups)
 {
     BTRFS_VBR *DestVBR = Dest, *SrcVBR = Src;
 
@@ -262,7 +398,7 @@ bool BtrfsInstall(uint8_t PartitionNumber,
 
 bool ExtInstall(uint8_t PartitionNumber,
                 uint64_t *PartitionStartSector, uint64_t *PartitionEndSector,
-                void *Dest, void *Src)
+                void *Dest, void *Src, PATCH_LIST *Backups)
 {
     EXT_VBR *DestVBR = Dest, *SrcVBR = Src;
 
@@ -320,7 +456,7 @@ bool ExtInstall(uint8_t PartitionNumber,
 
 bool FatInstall(uint8_t PartitionNumber,
                 uint64_t *PartitionStartSector, uint64_t *PartitionEndSector,
-                void *Dest, void *Src)
+                void *Dest, void *Src, PATCH_LIST *Backups)
 {
     FAT_VBR *DestVBRHeader = Dest, *SrcVBRHeader = Src;
     bool IsDest32 = IsFat32(Dest), IsSrc32 = IsFat32(Src);
@@ -352,6 +488,13 @@ bool FatInstall(uint8_t PartitionNumber,
         DestVBR->BootPartition = PartitionNumber;
         DestVBR->VBRSignatureLow = SrcVBR->VBRSignatureLow;
         DestVBR->VBRSignatureHigh = SrcVBR->VBRSignatureHigh;
+
+        /* The backup boot record mirrors the boot sector, it lives inside the reserved sectors */
+        if (DestVBR->BackupBootSector && DestVBR->BackupBootSector != 0xFFFF &&
+            DestVBR->BackupBootSector < DestVBR->Header.ReservedSectors &&
+            !PatchListAdd(Backups, (uint64_t)DestVBR->BackupBootSector * SECTOR_SIZE,
+                          Dest, VBR_FILESYSTEM_FAT_SIZE))
+            return false;
     }
     else
     {
@@ -370,7 +513,7 @@ bool FatInstall(uint8_t PartitionNumber,
 
 bool NtfsInstall(uint8_t PartitionNumber,
                  uint64_t *PartitionStartSector, uint64_t *PartitionEndSector,
-                 void *Dest, void *Src)
+                 void *Dest, void *Src, PATCH_LIST *Backups)
 {
     NTFS_VBR *DestVBR = Dest, *SrcVBR = Src;
 
@@ -391,5 +534,78 @@ bool NtfsInstall(uint8_t PartitionNumber,
     DestVBR->VBRSignatureLow = SrcVBR->VBRSignatureLow;
     DestVBR->VBRSignatureHigh = SrcVBR->VBRSignatureHigh;
 
-    return true;
+    /* The backup boot sector is the one right past the volume, the last one of the partition */
+    uint64_t BackupSector = DestVBR->VolumeSectorCount;
+
+    if (memcmp(DestVBR->OemId, VBR_FILESYSTEM_OEM_NTFS_STRING, sizeof(DestVBR->OemId)) || !BackupSector)
+        return true;
+
+    /* Never trusted on its own, a foreign BPB could point anywhere on the device */
+    if (*PartitionEndSector <= *PartitionStartSector ||
+        BackupSector >= *PartitionEndSector - *PartitionStartSector)
+    {
+        printf(DEBUG_STRING STR_000044, (unsigned long long)BackupSector);
+        return true;
+    }
+
+    return PatchListAdd(Backups, BackupSector * SECTOR_SIZE, Dest, SECTOR_SIZE);
+}
+
+/* The BTRFS superblock lives at the 64KiB mark, the whole VBR is boot code */
+static const VBR_RANGE BtrfsRanges[] = {
+    {0, VBR_FILESYSTEM_BTRFS_SIZE},
+};
+
+/* Only the first KiB, the superblock that follows is owned by the kernel */
+static const VBR_RANGE ExtRanges[] = {
+    {0, offsetof(EXT_VBR, InodesCount)},
+};
+
+/* The BPB and the volume state byte next to the drive number are left alone */
+static const VBR_RANGE Fat16Ranges[] = {
+    {offsetof(FAT16_VBR, Header.JumpOpcode), sizeof(((FAT_VBR *)0)->JumpOpcode)},
+    {offsetof(FAT16_VBR, BootDrive), sizeof(((FAT16_VBR *)0)->BootDrive)},
+    {offsetof(FAT16_VBR, VBRCode), VBR_FILESYSTEM_FAT_SIZE - offsetof(FAT16_VBR, VBRCode)},
+};
+
+static const VBR_RANGE Fat32Ranges[] = {
+    {offsetof(FAT32_VBR, Header.JumpOpcode), sizeof(((FAT_VBR *)0)->JumpOpcode)},
+    {offsetof(FAT32_VBR, BootDrive), sizeof(((FAT32_VBR *)0)->BootDrive)},
+    {offsetof(FAT32_VBR, VBRCode), VBR_FILESYSTEM_FAT32_SIZE - offsetof(FAT32_VBR, VBRCode)},
+};
+
+static const VBR_RANGE NtfsRanges[] = {
+    {offsetof(NTFS_VBR, JumpOpcode), sizeof(((NTFS_VBR *)0)->JumpOpcode)},
+    {offsetof(NTFS_VBR, BootDrive), sizeof(((NTFS_VBR *)0)->BootDrive)},
+    {offsetof(NTFS_VBR, VBRCode), VBR_FILESYSTEM_NTFS_SIZE - offsetof(NTFS_VBR, VBRCode)},
+};
+
+size_t BtrfsBootCodeRanges(void *Dest, const VBR_RANGE **Ranges)
+{
+    *Ranges = BtrfsRanges;
+    return sizeof(BtrfsRanges) / sizeof(VBR_RANGE);
+}
+
+size_t ExtBootCodeRanges(void *Dest, const VBR_RANGE **Ranges)
+{
+    *Ranges = ExtRanges;
+    return sizeof(ExtRanges) / sizeof(VBR_RANGE);
+}
+
+size_t FatBootCodeRanges(void *Dest, const VBR_RANGE **Ranges)
+{
+    if (IsFat32(Dest))
+    {
+        *Ranges = Fat32Ranges;
+        return sizeof(Fat32Ranges) / sizeof(VBR_RANGE);
+    }
+
+    *Ranges = Fat16Ranges;
+    return sizeof(Fat16Ranges) / sizeof(VBR_RANGE);
+}
+
+size_t NtfsBootCodeRanges(void *Dest, const VBR_RANGE **Ranges)
+{
+    *Ranges = NtfsRanges;
+    return sizeof(NtfsRanges) / sizeof(VBR_RANGE);
 }
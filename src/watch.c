@@ -0,0 +1,429 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Helper code to flash drives as soon as they are plugged in
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <watch.h>
+#include <sync.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <poll.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+bool WatchMode;
+
+static sem_t WatchWorkers;
+static volatile sig_atomic_t WatchStopping = 0;
+
+/* Workers still running, the run only ends once all of them reported */
+static size_t WatchActive = 0;
+static pthread_mutex_t WatchActiveLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t WatchIdle = PTHREAD_COND_INITIALIZER;
+
+static WATCH_DISK *WatchDisks = NULL;
+static size_t WatchDiskCount = 0;
+
+static TARGET_FILTER *WatchFilter;
+static uint8_t WatchPartitionNumber;
+static TARGET_ROUTINE WatchRoutine;
+
+static char *WatchGetValue(char *Buffer, size_t Size, char *Key)
+{
+    size_t KeyLength = strlen(Key);
+
+    /* The event is a list of NUL terminated KEY=VALUE strings after the ACTION@DEVPATH header */
+    for (size_t i = 0; i < Size; i += strlen(&Buffer[i]) + 1)
+    {
+        if (!strncmp(&Buffer[i], Key, KeyLength) && Buffer[i + KeyLength] == '=')
+            return &Buffer[i + KeyLength + 1];
+    }
+
+    return NULL;
+}
+
+/* The slot is the hub port the drive hangs from, the path component right above the SCSI host */
+static void WatchGetSlot(char *DevicePath, char *Name, char *Slot, size_t SlotSize)
+{
+    char *Host = strstr(DevicePath, "/host");
+    char *Start = Host;
+
+    while (Start && Start > DevicePath && Start[-1] != '/')
+        Start--;
+
+    if (!Host || Start == Host)
+    {
+        snprintf(Slot, SlotSize, "%s", Name);
+        return;
+    }
+
+    size_t Length = (size_t)(Host - Start);
+    char *Interface = memchr(Start, ':', Length);
+
+    if (Interface)
+        Length = (size_t)(Interface - Start);
+
+    snprintf(Slot, SlotSize, "%.*s", (int)Length, Start);
+}
+
+static void *WatchWorker(void *Parameter)
+{
+    WATCH_JOB *Job = Parameter;
+    TARGET *Target = &Job->Target;
+    bool Matched = false;
+
+    sem_wait(&WatchWorkers);
+
+    /* The node and the media size can show up a little after the event */
+    for (int Waited = 0; Waited < WATCH_NODE_TIMEOUT_MS && !Matched && !WatchStopping; Waited += WATCH_NODE_POLL_MS)
+    {
+        Matched = TargetProbeName(Job->Filter, Job->PartitionNumber, Target);
+
+        /* Excluded and probed but unmatched drives are settled, only a missing node is worth waiting for */
+        if (!Matched && (Target->Excluded || Target->Size))
+            break;
+
+        if (!Matched)
+            usleep(WATCH_NODE_POLL_MS * 1000);
+    }
+
+    /* Once stopping, drives still queued are left alone rather than started */
+    if (Matched && !WatchStopping)
+    {
+        printf(STR_000066, Job->Slot, Target->Device, STR_000067);
+        printf(STR_000066, Job->Slot, Target->Device, Job->Routine(Target) ? STR_000018 : STR_000019);
+    }
+
+    sem_post(&WatchWorkers);
+    free(Job);
+
+    pthread_mutex_lock(&WatchActiveLock);
+
+    if (!--WatchActive)
+        pthread_cond_broadcast(&WatchIdle);
+
+    pthread_mutex_unlock(&WatchActiveLock);
+    return NULL;
+}
+
+static void WatchStop(int Signal)
+{
+    (void)Signal;
+    WatchStopping = 1;
+}
+
+static uint64_t WatchReadSequence(char *Name)
+{
+    char Path[PATH_MAX];
+    unsigned long long Sequence = 0;
+
+    snprintf(Path, sizeof(Path), TARGET_SYSFS_BLOCK_PATH "/%s/" WATCH_DISK_SEQUENCE_FILE, Name);
+
+    FILE *File = fopen(Path, "r");
+
+    if (File)
+    {
+        if (fscanf(File, "%llu", &Sequence) != 1)
+            Sequence = 0;
+
+        fclose(File);
+    }
+
+    return (uint64_t)Sequence;
+}
+
+static WATCH_DISK *WatchFindDisk(char *Name)
+{
+    for (size_t i = 0; i < WatchDiskCount; i++)
+    {
+        if (!strcmp(WatchDisks[i].Name, Name))
+            return &WatchDisks[i];
+    }
+
+    return NULL;
+}
+
+static void WatchForgetDisk(WATCH_DISK *Disk)
+{
+    *Disk = WatchDisks[--WatchDiskCount];
+}
+
+/* Returns false when the disk was already handled, so a rescan never flashes a drive twice */
+static bool WatchRememberDisk(char *Name, uint64_t Sequence)
+{
+    WATCH_DISK *Disk = WatchFindDisk(Name);
+
+    if (Disk)
+    {
+        Disk->Present = true;
+
+        if (Disk->Sequence == Sequence)
+            return false;
+
+        Disk->Sequence = Sequence;
+        return true;
+    }
+
+    WATCH_DISK *Resized = realloc(WatchDisks, (WatchDiskCount + 1) * sizeof(WATCH_DISK));
+
+    if (!Resized)
+        return true;
+
+    WatchDisks = Resized;
+    Disk = &WatchDisks[WatchDiskCount++];
+
+    snprintf(Disk->Name, sizeof(Disk->Name), "%s", Name);
+    Disk->Sequence = Sequence;
+    Disk->Present = true;
+    return true;
+}
+
+static void WatchDispatch(char *Name, char *DevicePath, uint64_t Sequence)
+{
+    if (!WatchRememberDisk(Name, Sequence))
+        return;
+
+    WATCH_JOB *Job = calloc(1, sizeof(WATCH_JOB));
+    pthread_t Thread;
+
+    if (!Job)
+    {
+        printf(DEBUG_STRING STR_000004);
+        return;
+    }
+
+    strcpy(Job->Target.Name, Name);
+    Job->Filter = WatchFilter;
+    Job->PartitionNumber = WatchPartitionNumber;
+    Job->Routine = WatchRoutine;
+    WatchGetSlot(DevicePath, Name, Job->Slot, sizeof(Job->Slot));
+
+    pthread_mutex_lock(&WatchActiveLock);
+    WatchActive++;
+    pthread_mutex_unlock(&WatchActiveLock);
+
+    if (pthread_create(&Thread, NULL, WatchWorker, Job))
+    {
+        free(Job);
+
+        pthread_mutex_lock(&WatchActiveLock);
+        WatchActive--;
+        pthread_mutex_unlock(&WatchActiveLock);
+        return;
+    }
+
+    pthread_detach(Thread);
+}
+
+/*
+ * Walks the disks the kernel has right now. At startup they are only
+ * remembered, the drives already plugged in are not the ones being waited
+ * for. After events were lost the new ones are flashed and the gone ones
+ * forgotten, as their add and remove events would have done
+ */
+static void WatchRescan(bool Dispatch)
+{
+    DIR *Directory = opendir(TARGET_SYSFS_BLOCK_PATH);
+    struct dirent *Entry;
+
+    if (!Directory)
+        return;
+
+    for (size_t i = 0; i < WatchDiskCount; i++)
+        WatchDisks[i].Present = false;
+
+    while ((Entry = readdir(Directory)))
+    {
+        char Link[PATH_MAX], DevicePath[PATH_MAX];
+
+        if (Entry->d_name[0] == '.' || strlen(Entry->d_name) >= TARGET_NAME_SIZE)
+            continue;
+
+        uint64_t Sequence = WatchReadSequence(Entry->d_name);
+
+        if (!Dispatch)
+        {
+            WatchRememberDisk(Entry->d_name, Sequence);
+            continue;
+        }
+
+        snprintf(Link, sizeof(Link), TARGET_SYSFS_BLOCK_PATH "/%s", Entry->d_name);
+
+        ssize_t Length = readlink(Link, DevicePath, sizeof(DevicePath) - 1);
+
+        DevicePath[Length > 0 ? Length : 0] = '\0';
+        WatchDispatch(Entry->d_name, DevicePath, Sequence);
+    }
+
+    closedir(Directory);
+
+    for (size_t i = WatchDiskCount; i > 0; i--)
+    {
+        if (!WatchDisks[i - 1].Present)
+            WatchForgetDisk(&WatchDisks[i - 1]);
+    }
+}
+
+bool WatchRun(TARGET_FILTER *Filter, uint8_t PartitionNumber, TARGET_ROUTINE Routine)
+{
+    struct sockaddr_nl Address = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = WATCH_KERNEL_GROUP,
+    };
+    struct sigaction Stop = {
+        .sa_handler = WatchStop,
+    };
+    struct sigaction PreviousInterrupt, PreviousTerminate;
+    sigset_t Signals, PreviousSignals, WaitSignals;
+    char Buffer[WATCH_BUFFER_SIZE + 1];
+    int ReceiveBufferSize = WATCH_RECEIVE_BUFFER_SIZE;
+    bool Result = true;
+
+    /* There is no end of the run to hold a barrier on, and a stick can be pulled as soon as it is reported */
+    if (DurabilityModeGiven && DurabilityMode == SyncModeGroup)
+    {
+        printf(DEBUG_STRING STR_000089);
+        return false;
+    }
+
+    if (!DurabilityModeGiven)
+        DurabilityMode = SyncModeTarget;
+
+    int Socket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+
+    if (Socket == -1 || bind(Socket, (struct sockaddr *)&Address, sizeof(Address)))
+    {
+        printf(DEBUG_STRING STR_000068);
+
+        if (Socket != -1)
+            close(Socket);
+
+        return false;
+    }
+
+    /* A hub full of sticks floods the socket, only the privileged call can go past the system limit */
+    if (setsockopt(Socket, SOL_SOCKET, SO_RCVBUFFORCE, &ReceiveBufferSize, sizeof(ReceiveBufferSize)))
+        setsockopt(Socket, SOL_SOCKET, SO_RCVBUF, &ReceiveBufferSize, sizeof(ReceiveBufferSize));
+
+    WatchFilter = Filter;
+    WatchPartitionNumber = PartitionNumber;
+    WatchRoutine = Routine;
+    WatchStopping = 0;
+    WatchRescan(false);
+
+    /* Only delivered while waiting for an event, the workers inherit the blocked mask */
+    sigemptyset(&Signals);
+    sigaddset(&Signals, SIGINT);
+    sigaddset(&Signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &Signals, &PreviousSignals);
+
+    WaitSignals = PreviousSignals;
+    sigdelset(&WaitSignals, SIGINT);
+    sigdelset(&WaitSignals, SIGTERM);
+
+    sigemptyset(&Stop.sa_mask);
+    sigaction(SIGINT, &Stop, &PreviousInterrupt);
+    sigaction(SIGTERM, &Stop, &PreviousTerminate);
+
+    sem_init(&WatchWorkers, 0, WATCH_MAX_WORKERS);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf(DEBUG_STRING STR_000069);
+
+    while (!WatchStopping)
+    {
+        struct pollfd Poll = {
+            .fd = Socket,
+            .events = POLLIN,
+        };
+
+        if (ppoll(&Poll, 1, NULL, &WaitSignals) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            printf(DEBUG_STRING STR_000090);
+            Result = false;
+            break;
+        }
+
+        ssize_t Size = recv(Socket, Buffer, WATCH_BUFFER_SIZE, MSG_DONTWAIT);
+
+        if (Size == -1)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+                continue;
+
+            /* The socket overflowed, whatever was dropped is still visible in sysfs */
+            if (errno == ENOBUFS)
+            {
+                printf(DEBUG_STRING STR_000091);
+                WatchRescan(true);
+                continue;
+            }
+
+            printf(DEBUG_STRING STR_000090);
+            Result = false;
+            break;
+        }
+
+        if (!Size)
+            continue;
+
+        Buffer[Size] = '\0';
+
+        char *Action = WatchGetValue(Buffer, (size_t)Size, "ACTION");
+        char *Subsystem = WatchGetValue(Buffer, (size_t)Size, "SUBSYSTEM");
+        char *DeviceType = WatchGetValue(Buffer, (size_t)Size, "DEVTYPE");
+        char *DeviceName = WatchGetValue(Buffer, (size_t)Size, "DEVNAME");
+        char *DevicePath = WatchGetValue(Buffer, (size_t)Size, "DEVPATH");
+        char *DiskSequence = WatchGetValue(Buffer, (size_t)Size, "DISKSEQ");
+
+        /* Only whole disks, their partitions come through the disk handle */
+        if (!Action || !Subsystem || !DeviceType || !DeviceName || !DevicePath ||
+            strcmp(Subsystem, "block") || strcmp(DeviceType, "disk") || strlen(DeviceName) >= TARGET_NAME_SIZE)
+            continue;
+
+        if (!strcmp(Action, "remove"))
+        {
+            WATCH_DISK *Disk = WatchFindDisk(DeviceName);
+
+            if (Disk)
+                WatchForgetDisk(Disk);
+
+            continue;
+        }
+
+        if (strcmp(Action, "add"))
+            continue;
+
+        WatchDispatch(DeviceName, DevicePath,
+                      DiskSequence ? strtoull(DiskSequence, NULL, 10) : WatchReadSequence(DeviceName));
+    }
+
+    if (WatchStopping)
+        printf(DEBUG_STRING STR_000092);
+
+    pthread_mutex_lock(&WatchActiveLock);
+
+    while (WatchActive)
+        pthread_cond_wait(&WatchIdle, &WatchActiveLock);
+
+    pthread_mutex_unlock(&WatchActiveLock);
+
+    sigaction(SIGINT, &PreviousInterrupt, NULL);
+    sigaction(SIGTERM, &PreviousTerminate, NULL);
+    pthread_sigmask(SIG_SETMASK, &PreviousSignals, NULL);
+
+    sem_destroy(&WatchWorkers);
+    close(Socket);
+
+    free(WatchDisks);
+    WatchDisks = NULL;
+    WatchDiskCount = 0;
+    return Result;
+}
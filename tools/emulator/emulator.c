@@ -0,0 +1,1965 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     Real mode x86 interpreter that boots the installed MBR/VBR chain and profiles its disk I/O
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <emulator.h>
+
+#define EMULATOR_PARAGRAPHS (EMULATOR_MEMORY_SIZE >> 4)
+
+enum
+{
+    RegisterAX,
+    RegisterCX,
+    RegisterDX,
+    RegisterBX,
+    RegisterSP,
+    RegisterBP,
+    RegisterSI,
+    RegisterDI,
+};
+
+enum
+{
+    SegmentES,
+    SegmentCS,
+    SegmentSS,
+    SegmentDS,
+    SegmentFS,
+    SegmentGS,
+};
+
+enum
+{
+    AluAdd,
+    AluOr,
+    AluAdc,
+    AluSbb,
+    AluAnd,
+    AluSub,
+    AluXor,
+    AluCmp,
+};
+
+typedef struct _EMULATOR_OPERAND
+{
+    bool IsRegister;
+    uint8_t Register;
+    uint8_t Reg;
+    uint32_t Offset;
+    uint32_t Linear;
+} EMULATOR_OPERAND;
+
+typedef struct _EMULATOR_VBR_RANGE
+{
+    uint64_t StartSector;
+    uint64_t EndSector;
+} EMULATOR_VBR_RANGE;
+
+typedef struct _EMULATOR
+{
+    uint32_t Registers[8];
+    uint16_t Segments[6];
+    uint16_t IP;
+    uint32_t Flags;
+    uint32_t CR0;
+
+    uint8_t *Memory;
+    int64_t *Origin;
+
+    int Disk;
+    uint64_t DiskSectors;
+    EMULATOR_VBR_RANGE VbrRanges[4];
+    size_t VbrRangeCount;
+
+    int SegmentOverride;
+    bool OperandSize32;
+    bool AddressSize32;
+    uint8_t Repeat;
+    uint16_t InstructionIP;
+
+    EMULATOR_STAGE Stage;
+    EMULATOR_REPORT *Report;
+    bool Running;
+
+    char Console[EMULATOR_CONSOLE_SIZE];
+    size_t ConsoleLength;
+} EMULATOR;
+
+/* Memory */
+
+static uint32_t Mask(int Size)
+{
+    return Size == 4 ? 0xFFFFFFFF : (1u << (Size * 8)) - 1;
+}
+
+static uint32_t SignBit(int Size)
+{
+    return 1u << (Size * 8 - 1);
+}
+
+static uint32_t SignExtend(uint32_t Value, int Size)
+{
+    if (Size == 1)
+        return (uint32_t)(int32_t)(int8_t)Value;
+
+    if (Size == 2)
+        return (uint32_t)(int32_t)(int16_t)Value;
+
+    return Value;
+}
+
+static uint32_t MemRead(EMULATOR *Emulator, uint32_t Linear, int Size)
+{
+    uint32_t Value = 0;
+
+    for (int i = 0; i < Size; i++)
+        Value |= (uint32_t)Emulator->Memory[(Linear + i) % EMULATOR_MEMORY_SIZE] << (i * 8);
+
+    return Value;
+}
+
+static void MemWrite(EMULATOR *Emulator, uint32_t Linear, uint32_t Value, int Size)
+{
+    for (int i = 0; i < Size; i++)
+        Emulator->Memory[(Linear + i) % EMULATOR_MEMORY_SIZE] = (uint8_t)(Value >> (i * 8));
+}
+
+static uint32_t SegmentLinear(EMULATOR *Emulator, int Segment, uint32_t Offset)
+{
+    return ((uint32_t)Emulator->Segments[Segment] << 4) + Offset;
+}
+
+static uint32_t Fetch(EMULATOR *Emulator, int Size)
+{
+    uint32_t Value = MemRead(Emulator, SegmentLinear(Emulator, SegmentCS, Emulator->IP), Size);
+
+    Emulator->IP += Size;
+    return Value;
+}
+
+/* Registers */
+
+static int OperandSize(EMULATOR *Emulator)
+{
+    return Emulator->OperandSize32 ? 4 : 2;
+}
+
+static uint32_t RegRead(EMULATOR *Emulator, int Register, int Size)
+{
+    if (Size == 1)
+        return Register < 4 ? Emulator->Registers[Register] & 0xFF
+                            : (Emulator->Registers[Register - 4] >> 8) & 0xFF;
+
+    return Emulator->Registers[Register] & Mask(Size);
+}
+
+static void RegWrite(EMULATOR *Emulator, int Register, uint32_t Value, int Size)
+{
+    uint32_t *Target = &Emulator->Registers[Register];
+
+    if (Size == 1)
+    {
+        if (Register < 4)
+            *Target = (*Target & ~0xFFu) | (Value & 0xFF);
+        else
+            Emulator->Registers[Register - 4] = (Emulator->Registers[Register - 4] & ~0xFF00u) | ((Value & 0xFF) << 8);
+    }
+    else if (Size == 2)
+        *Target = (*Target & ~0xFFFFu) | (Value & 0xFFFF);
+    else
+        *Target = Value;
+}
+
+/* Registers used as addresses wrap at 64KiB unless the address size prefix is used */
+static uint32_t IndexRead(EMULATOR *Emulator, int Register)
+{
+    return RegRead(Emulator, Register, Emulator->AddressSize32 ? 4 : 2);
+}
+
+static void IndexWrite(EMULATOR *Emulator, int Register, uint32_t Value)
+{
+    RegWrite(Emulator, Register, Value, Emulator->AddressSize32 ? 4 : 2);
+}
+
+static void Push(EMULATOR *Emulator, uint32_t Value, int Size)
+{
+    uint16_t SP = (uint16_t)(RegRead(Emulator, RegisterSP, 2) - Size);
+
+    RegWrite(Emulator, RegisterSP, SP, 2);
+    MemWrite(Emulator, SegmentLinear(Emulator, SegmentSS, SP), Value, Size);
+}
+
+static uint32_t Pop(EMULATOR *Emulator, int Size)
+{
+    uint16_t SP = (uint16_t)RegRead(Emulator, RegisterSP, 2);
+    uint32_t Value = MemRead(Emulator, SegmentLinear(Emulator, SegmentSS, SP), Size);
+
+    RegWrite(Emulator, RegisterSP, (uint16_t)(SP + Size), 2);
+    return Value;
+}
+
+static void SetFlag(EMULATOR *Emulator, uint32_t Flag, bool Value)
+{
+    if (Value)
+        Emulator->Flags |= Flag;
+    else
+        Emulator->Flags &= ~Flag;
+}
+
+static bool GetFlag(EMULATOR *Emulator, uint32_t Flag)
+{
+    return (Emulator->Flags & Flag) != 0;
+}
+
+static void Stop(EMULATOR *Emulator, const char *Reason)
+{
+    Emulator->Report->StopReason = Reason;
+    Emulator->Running = false;
+}
+
+/* Operand decoding */
+
+static void DecodeModRM(EMULATOR *Emulator, EMULATOR_OPERAND *Operand)
+{
+    uint8_t ModRM = (uint8_t)Fetch(Emulator, 1);
+    uint8_t Mod = ModRM >> 6, RM = ModRM & 7;
+    int Segment = SegmentDS;
+    uint32_t Offset = 0;
+
+    Operand->Reg = (ModRM >> 3) & 7;
+    Operand->IsRegister = Mod == 3;
+    Operand->Register = RM;
+
+    if (Operand->IsRegister)
+        return;
+
+    if (!Emulator->AddressSize32)
+    {
+        uint32_t *R = Emulator->Registers;
+
+        switch (RM)
+        {
+        case 0:
+            Offset = R[RegisterBX] + R[RegisterSI];
+            break;
+        case 1:
+            Offset = R[RegisterBX] + R[RegisterDI];
+            break;
+        case 2:
+            Offset = R[RegisterBP] + R[RegisterSI];
+            Segment = SegmentSS;
+            break;
+        case 3:
+            Offset = R[RegisterBP] + R[RegisterDI];
+            Segment = SegmentSS;
+            break;
+        case 4:
+            Offset = R[RegisterSI];
+            break;
+        case 5:
+            Offset = R[RegisterDI];
+            break;
+        case 6:
+            if (Mod == 0)
+                Offset = Fetch(Emulator, 2);
+            else
+            {
+                Offset = R[RegisterBP];
+                Segment = SegmentSS;
+            }
+            break;
+        case 7:
+            Offset = R[RegisterBX];
+            break;
+        }
+
+        if (Mod == 1)
+            Offset += SignExtend(Fetch(Emulator, 1), 1);
+        else if (Mod == 2)
+            Offset += Fetch(Emulator, 2);
+
+        Offset &= 0xFFFF;
+    }
+    else
+    {
+        if (RM == 4)
+        {
+            uint8_t SIB = (uint8_t)Fetch(Emulator, 1);
+            uint8_t Scale = SIB >> 6, Index = (SIB >> 3) & 7, Base = SIB & 7;
+
+            if (Base == 5 && Mod == 0)
+                Offset = Fetch(Emulator, 4);
+            else
+            {
+                Offset = Emulator->Registers[Base];
+
+                if (Base == RegisterSP || Base == RegisterBP)
+                    Segment = SegmentSS;
+            }
+
+            if (Index != 4)
+                Offset += Emulator->Registers[Index] << Scale;
+        }
+        else if (RM == 5 && Mod == 0)
+            Offset = Fetch(Emulator, 4);
+        else
+        {
+            Offset = Emulator->Registers[RM];
+
+            if (RM == RegisterBP)
+                Segment = SegmentSS;
+        }
+
+        if (Mod == 1)
+            Offset += SignExtend(Fetch(Emulator, 1), 1);
+        else if (Mod == 2)
+            Offset += Fetch(Emulator, 4);
+    }
+
+    if (Emulator->SegmentOverride != -1)
+        Segment = Emulator->SegmentOverride;
+
+    Operand->Offset = Offset;
+    Operand->Linear = SegmentLinear(Emulator, Segment, Offset);
+}
+
+static uint32_t OperandRead(EMULATOR *Emulator, EMULATOR_OPERAND *Operand, int Size)
+{
+    if (Operand->IsRegister)
+        return RegRead(Emulator, Operand->Register, Size);
+
+    return MemRead(Emulator, Operand->Linear, Size);
+}
+
+static void OperandWrite(EMULATOR *Emulator, EMULATOR_OPERAND *Operand, uint32_t Value, int Size)
+{
+    if (Operand->IsRegister)
+        RegWrite(Emulator, Operand->Register, Value, Size);
+    else
+        MemWrite(Emulator, Operand->Linear, Value, Size);
+}
+
+/* Arithmetic */
+
+static void SetResultFlags(EMULATOR *Emulator, uint32_t Result, int Size)
+{
+    Result &= Mask(Size);
+
+    SetFlag(Emulator, EMULATOR_FLAG_ZF, Result == 0);
+    SetFlag(Emulator, EMULATOR_FLAG_SF, (Result & SignBit(Size)) != 0);
+    SetFlag(Emulator, EMULATOR_FLAG_PF, !__builtin_parity(Result & 0xFF));
+}
+
+static uint32_t Alu(EMULATOR *Emulator, int Operation, uint32_t A, uint32_t B, int Size)
+{
+    uint32_t ResultMask = Mask(Size), Sign = SignBit(Size);
+    uint64_t Carry = 0, Result;
+
+    A &= ResultMask;
+    B &= ResultMask;
+
+    switch (Operation)
+    {
+    case AluAdc:
+        Carry = GetFlag(Emulator, EMULATOR_FLAG_CF);
+        /* fall through */
+    case AluAdd:
+        Result = (uint64_t)A + B + Carry;
+        SetFlag(Emulator, EMULATOR_FLAG_CF, Result > ResultMask);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, ((A ^ Result) & (B ^ Result) & Sign) != 0);
+        SetFlag(Emulator, EMULATOR_FLAG_AF, ((A ^ B ^ Result) & 0x10) != 0);
+        break;
+
+    case AluSbb:
+        Carry = GetFlag(Emulator, EMULATOR_FLAG_CF);
+        /* fall through */
+    case AluSub:
+    case AluCmp:
+        Result = (uint64_t)A - B - Carry;
+        SetFlag(Emulator, EMULATOR_FLAG_CF, (uint64_t)A < (uint64_t)B + Carry);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, ((A ^ B) & (A ^ Result) & Sign) != 0);
+        SetFlag(Emulator, EMULATOR_FLAG_AF, ((A ^ B ^ Result) & 0x10) != 0);
+        break;
+
+    case AluOr:
+        Result = A | B;
+        goto Logic;
+    case AluAnd:
+        Result = A & B;
+        goto Logic;
+    default:
+        Result = A ^ B;
+    Logic:
+        SetFlag(Emulator, EMULATOR_FLAG_CF, false);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, false);
+        SetFlag(Emulator, EMULATOR_FLAG_AF, false);
+        break;
+    }
+
+    SetResultFlags(Emulator, (uint32_t)Result, Size);
+
+    return (uint32_t)Result & ResultMask;
+}
+
+static uint32_t IncDec(EMULATOR *Emulator, uint32_t Value, bool Decrement, int Size)
+{
+    bool Carry = GetFlag(Emulator, EMULATOR_FLAG_CF);
+    uint32_t Result = Alu(Emulator, Decrement ? AluSub : AluAdd, Value, 1, Size);
+
+    SetFlag(Emulator, EMULATOR_FLAG_CF, Carry);
+    return Result;
+}
+
+static uint32_t Shift(EMULATOR *Emulator, int Operation, uint32_t Value, uint8_t Count, int Size)
+{
+    int Bits = Size * 8;
+    uint32_t ResultMask = Mask(Size), Sign = SignBit(Size);
+    uint32_t Result = Value &= ResultMask;
+    bool Carry = GetFlag(Emulator, EMULATOR_FLAG_CF);
+
+    Count &= 0x1F;
+    if (!Count)
+        return Value;
+
+    switch (Operation)
+    {
+    case 0:
+    {
+        uint8_t Rotate = Count % Bits;
+
+        if (Rotate)
+            Result = ((Value << Rotate) | (Value >> (Bits - Rotate))) & ResultMask;
+
+        SetFlag(Emulator, EMULATOR_FLAG_CF, Result & 1);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, ((Result & Sign) != 0) ^ (Result & 1));
+        return Result;
+    }
+
+    case 1:
+    {
+        uint8_t Rotate = Count % Bits;
+
+        if (Rotate)
+            Result = ((Value >> Rotate) | (Value << (Bits - Rotate))) & ResultMask;
+
+        SetFlag(Emulator, EMULATOR_FLAG_CF, (Result & Sign) != 0);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, ((Result ^ (Result << 1)) & Sign) != 0);
+        return Result;
+    }
+
+    case 2:
+        for (uint8_t i = 0; i < Count; i++)
+        {
+            bool Out = (Result & Sign) != 0;
+
+            Result = ((Result << 1) | Carry) & ResultMask;
+            Carry = Out;
+        }
+
+        SetFlag(Emulator, EMULATOR_FLAG_CF, Carry);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, ((Result & Sign) != 0) ^ Carry);
+        return Result;
+
+    case 3:
+        for (uint8_t i = 0; i < Count; i++)
+        {
+            bool Out = Result & 1;
+
+            Result = (Result >> 1) | (Carry ? Sign : 0);
+            Carry = Out;
+        }
+
+        SetFlag(Emulator, EMULATOR_FLAG_CF, Carry);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, ((Result ^ (Result << 1)) & Sign) != 0);
+        return Result;
+
+    case 4:
+    case 6:
+    {
+        uint64_t Wide = (uint64_t)Value << Count;
+
+        Result = (uint32_t)Wide & ResultMask;
+        SetFlag(Emulator, EMULATOR_FLAG_CF, Count <= Bits && ((Wide >> Bits) & 1));
+        SetFlag(Emulator, EMULATOR_FLAG_OF, ((Result & Sign) != 0) ^ GetFlag(Emulator, EMULATOR_FLAG_CF));
+        break;
+    }
+
+    case 5:
+        Result = Count >= Bits ? 0 : Value >> Count;
+        SetFlag(Emulator, EMULATOR_FLAG_CF, Count <= Bits && ((Value >> (Count - 1)) & 1));
+        SetFlag(Emulator, EMULATOR_FLAG_OF, (Value & Sign) != 0);
+        break;
+
+    default:
+    {
+        int64_t Signed = (int32_t)SignExtend(Value, Size);
+
+        Result = (uint32_t)(Signed >> (Count >= Bits ? Bits - 1 : Count)) & ResultMask;
+        SetFlag(Emulator, EMULATOR_FLAG_CF, (Signed >> (Count > Bits ? Bits - 1 : Count - 1)) & 1);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, false);
+        break;
+    }
+    }
+
+    SetResultFlags(Emulator, Result, Size);
+    return Result;
+}
+
+static uint32_t DoubleShift(EMULATOR *Emulator, bool Left, uint32_t Value, uint32_t Fill, uint8_t Count, int Size)
+{
+    int Bits = Size * 8;
+    uint64_t Wide;
+    uint32_t Result;
+
+    Count &= 0x1F;
+    if (!Count || Count > Bits)
+        return Value;
+
+    if (Left)
+    {
+        Wide = ((uint64_t)(Value & Mask(Size)) << Bits) | (Fill & Mask(Size));
+        Result = (uint32_t)(Wide >> (Bits - Count)) & Mask(Size);
+        SetFlag(Emulator, EMULATOR_FLAG_CF, (Wide >> (2 * Bits - Count)) & 1);
+    }
+    else
+    {
+        Wide = ((uint64_t)(Fill & Mask(Size)) << Bits) | (Value & Mask(Size));
+        Result = (uint32_t)(Wide >> Count) & Mask(Size);
+        SetFlag(Emulator, EMULATOR_FLAG_CF, (Wide >> (Count - 1)) & 1);
+    }
+
+    SetFlag(Emulator, EMULATOR_FLAG_OF, ((Result ^ Value) & SignBit(Size)) != 0);
+    SetResultFlags(Emulator, Result, Size);
+    return Result;
+}
+
+static bool Condition(EMULATOR *Emulator, uint8_t Code)
+{
+    bool CF = GetFlag(Emulator, EMULATOR_FLAG_CF), ZF = GetFlag(Emulator, EMULATOR_FLAG_ZF);
+    bool SF = GetFlag(Emulator, EMULATOR_FLAG_SF), OF = GetFlag(Emulator, EMULATOR_FLAG_OF);
+    bool PF = GetFlag(Emulator, EMULATOR_FLAG_PF);
+    bool Result;
+
+    switch (Code >> 1)
+    {
+    case 0:
+        Result = OF;
+        break;
+    case 1:
+        Result = CF;
+        break;
+    case 2:
+        Result = ZF;
+        break;
+    case 3:
+        Result = CF || ZF;
+        break;
+    case 4:
+        Result = SF;
+        break;
+    case 5:
+        Result = PF;
+        break;
+    case 6:
+        Result = SF != OF;
+        break;
+    default:
+        Result = ZF || SF != OF;
+        break;
+    }
+
+    return (Code & 1) ? !Result : Result;
+}
+
+static bool Multiply(EMULATOR *Emulator, uint32_t Source, bool Signed, int Size)
+{
+    uint32_t A = RegRead(Emulator, RegisterAX, Size);
+    uint64_t Result;
+    bool Overflow;
+
+    if (Signed)
+    {
+        int64_t Product = (int64_t)(int32_t)SignExtend(A, Size) * (int32_t)SignExtend(Source, Size);
+
+        Result = (uint64_t)Product;
+        Overflow = Product != (int64_t)(int32_t)SignExtend((uint32_t)Product & Mask(Size), Size);
+    }
+    else
+    {
+        Result = (uint64_t)A * Source;
+        Overflow = (Result >> (Size * 8)) != 0;
+    }
+
+    if (Size == 1)
+        RegWrite(Emulator, RegisterAX, (uint32_t)Result, 2);
+    else
+    {
+        RegWrite(Emulator, RegisterAX, (uint32_t)Result, Size);
+        RegWrite(Emulator, RegisterDX, (uint32_t)(Result >> (Size * 8)), Size);
+    }
+
+    SetFlag(Emulator, EMULATOR_FLAG_CF, Overflow);
+    SetFlag(Emulator, EMULATOR_FLAG_OF, Overflow);
+    return true;
+}
+
+static bool Divide(EMULATOR *Emulator, uint32_t Source, bool Signed, int Size)
+{
+    uint64_t Dividend;
+
+    if (Size == 1)
+        Dividend = RegRead(Emulator, RegisterAX, 2);
+    else
+        Dividend = ((uint64_t)RegRead(Emulator, RegisterDX, Size) << (Size * 8)) | RegRead(Emulator, RegisterAX, Size);
+
+    if (!(Source & Mask(Size)))
+        return false;
+
+    uint64_t Quotient, Remainder;
+
+    if (Signed)
+    {
+        int Bits = Size * 16;
+        int64_t SignedDividend = Bits == 64 ? (int64_t)Dividend
+                                            : (int64_t)(Dividend << (64 - Bits)) >> (64 - Bits);
+        int64_t SignedSource = (int32_t)SignExtend(Source, Size);
+
+        if (SignedSource == -1 && SignedDividend == INT64_MIN)
+            return false;
+
+        int64_t SignedQuotient = SignedDividend / SignedSource;
+
+        if (SignedQuotient != (int64_t)(int32_t)SignExtend((uint32_t)SignedQuotient & Mask(Size), Size))
+            return false;
+
+        Quotient = (uint64_t)SignedQuotient;
+        Remainder = (uint64_t)(SignedDividend % SignedSource);
+    }
+    else
+    {
+        Quotient = Dividend / Source;
+        Remainder = Dividend % Source;
+
+        if (Quotient > Mask(Size))
+            return false;
+    }
+
+    if (Size == 1)
+        RegWrite(Emulator, RegisterAX, ((uint32_t)Remainder & 0xFF) << 8 | ((uint32_t)Quotient & 0xFF), 2);
+    else
+    {
+        RegWrite(Emulator, RegisterAX, (uint32_t)Quotient, Size);
+        RegWrite(Emulator, RegisterDX, (uint32_t)Remainder, Size);
+    }
+
+    return true;
+}
+
+/* BIOS services */
+
+static bool IsVbrSector(EMULATOR *Emulator, uint64_t Sector)
+{
+    for (size_t i = 0; i < Emulator->VbrRangeCount; i++)
+    {
+        if (Sector >= Emulator->VbrRanges[i].StartSector && Sector < Emulator->VbrRanges[i].EndSector)
+            return true;
+    }
+
+    return false;
+}
+
+static void ConsoleWrite(EMULATOR *Emulator, char Character)
+{
+    if (Emulator->ConsoleLength < sizeof(Emulator->Console) - 1)
+        Emulator->Console[Emulator->ConsoleLength++] = Character;
+}
+
+static uint8_t DiskRead(EMULATOR *Emulator, uint64_t Sector, uint32_t Count, uint32_t Linear)
+{
+    uint8_t Buffer[SECTOR_SIZE];
+
+    Emulator->Report->DiskReadCalls++;
+
+    for (uint32_t i = 0; i < Count; i++)
+    {
+        if (Sector + i >= Emulator->DiskSectors ||
+            pread(Emulator->Disk, Buffer, SECTOR_SIZE, (off_t)((Sector + i) * SECTOR_SIZE)) != SECTOR_SIZE)
+            return 0x04;
+
+        uint32_t Destination = Linear + i * SECTOR_SIZE;
+
+        for (uint32_t j = 0; j < SECTOR_SIZE; j++)
+            Emulator->Memory[(Destination + j) % EMULATOR_MEMORY_SIZE] = Buffer[j];
+
+        /* Remember where every paragraph came from, to tell the boot stages apart */
+        for (uint32_t j = 0; j < SECTOR_SIZE; j += 16)
+            Emulator->Origin[((Destination + j) % EMULATOR_MEMORY_SIZE) >> 4] = (int64_t)(Sector + i);
+
+        Emulator->Report->SectorsRead++;
+    }
+
+    return 0;
+}
+
+static void DiskService(EMULATOR *Emulator)
+{
+    uint8_t Function = (uint8_t)RegRead(Emulator, 4, 1);
+    uint8_t Drive = (uint8_t)RegRead(Emulator, RegisterDX, 1);
+    uint8_t Status = 0;
+    uint64_t Cylinders = Emulator->DiskSectors / (EMULATOR_HEADS * EMULATOR_SECTORS_PER_TRACK);
+
+    /* An image smaller than one cylinder still reports a partial one, the last cylinder number cannot wrap */
+    if (Cylinders < 1)
+        Cylinders = 1;
+    else if (Cylinders > 1024)
+        Cylinders = 1024;
+
+    if (Drive != EMULATOR_BOOT_DRIVE)
+    {
+        RegWrite(Emulator, 4, 0x01, 1);
+        SetFlag(Emulator, EMULATOR_FLAG_CF, true);
+        return;
+    }
+
+    switch (Function)
+    {
+    case 0x00:
+        break;
+
+    case 0x02:
+    case 0x03:
+    {
+        uint8_t Count = (uint8_t)RegRead(Emulator, RegisterAX, 1);
+        uint8_t CL = (uint8_t)RegRead(Emulator, RegisterCX, 1);
+        uint32_t Cylinder = RegRead(Emulator, 5, 1) | ((CL & 0xC0) << 2);
+        uint32_t Head = RegRead(Emulator, 6, 1);
+        uint32_t Sector = CL & 0x3F;
+
+        if (!Sector || !Count)
+        {
+            Status = 0x01;
+            break;
+        }
+
+        uint64_t LBA = ((uint64_t)Cylinder * EMULATOR_HEADS + Head) * EMULATOR_SECTORS_PER_TRACK + Sector - 1;
+
+        if (Function == 0x03)
+            Emulator->Report->DiskWriteCalls++;
+        else
+            Status = DiskRead(Emulator, LBA, Count,
+                              SegmentLinear(Emulator, SegmentES, RegRead(Emulator, RegisterBX, 2)));
+        break;
+    }
+
+    case 0x08:
+        RegWrite(Emulator, 5, (uint32_t)(Cylinders - 1) & 0xFF, 1);
+        RegWrite(Emulator, RegisterCX, (((uint32_t)(Cylinders - 1) >> 2) & 0xC0) | EMULATOR_SECTORS_PER_TRACK, 1);
+        RegWrite(Emulator, 6, EMULATOR_HEADS - 1, 1);
+        RegWrite(Emulator, RegisterDX, 1, 1);
+        RegWrite(Emulator, RegisterBX, 0, 1);
+        break;
+
+    case 0x15:
+        RegWrite(Emulator, 4, 0x03, 1);
+        RegWrite(Emulator, RegisterCX, (uint32_t)(Emulator->DiskSectors >> 16), 2);
+        RegWrite(Emulator, RegisterDX, (uint32_t)Emulator->DiskSectors, 2);
+        SetFlag(Emulator, EMULATOR_FLAG_CF, false);
+        return;
+
+    case 0x41:
+        if (RegRead(Emulator, RegisterBX, 2) != 0x55AA)
+        {
+            Status = 0x01;
+            break;
+        }
+
+        RegWrite(Emulator, RegisterBX, 0xAA55, 2);
+        RegWrite(Emulator, RegisterCX, 0x0001, 2);
+        RegWrite(Emulator, 4, 0x30, 1);
+        SetFlag(Emulator, EMULATOR_FLAG_CF, false);
+        return;
+
+    case 0x42:
+    case 0x43:
+    {
+        uint32_t Packet = SegmentLinear(Emulator, SegmentDS, RegRead(Emulator, RegisterSI, 2));
+        uint32_t Count = MemRead(Emulator, Packet + 2, 2);
+        uint32_t Offset = MemRead(Emulator, Packet + 4, 2), Segment = MemRead(Emulator, Packet + 6, 2);
+        uint64_t LBA = MemRead(Emulator, Packet + 8, 4) | ((uint64_t)MemRead(Emulator, Packet + 12, 4) << 32);
+        uint32_t Linear = (Segment << 4) + Offset;
+
+        if (Offset == 0xFFFF && Segment == 0xFFFF && MemRead(Emulator, Packet, 1) >= 0x18)
+            Linear = MemRead(Emulator, Packet + 16, 4);
+
+        if (Function == 0x43)
+            Emulator->Report->DiskWriteCalls++;
+        else
+            Status = DiskRead(Emulator, LBA, Count, Linear);
+        break;
+    }
+
+    case 0x48:
+    {
+        uint32_t Buffer = SegmentLinear(Emulator, SegmentDS, RegRead(Emulator, RegisterSI, 2));
+
+        MemWrite(Emulator, Buffer, 0x1A, 2);
+        MemWrite(Emulator, Buffer + 2, 0x0002, 2);
+        MemWrite(Emulator, Buffer + 4, (uint32_t)Cylinders, 4);
+        MemWrite(Emulator, Buffer + 8, EMULATOR_HEADS, 4);
+        MemWrite(Emulator, Buffer + 12, EMULATOR_SECTORS_PER_TRACK, 4);
+        MemWrite(Emulator, Buffer + 16, (uint32_t)Emulator->DiskSectors, 4);
+        MemWrite(Emulator, Buffer + 20, (uint32_t)(Emulator->DiskSectors >> 32), 4);
+        MemWrite(Emulator, Buffer + 24, SECTOR_SIZE, 2);
+        break;
+    }
+
+    default:
+        Status = 0x01;
+        break;
+    }
+
+    RegWrite(Emulator, 4, Status, 1);
+    SetFlag(Emulator, EMULATOR_FLAG_CF, Status != 0);
+}
+
+static void Interrupt(EMULATOR *Emulator, uint8_t Vector)
+{
+    uint8_t Function = (uint8_t)RegRead(Emulator, 4, 1);
+
+    switch (Vector)
+    {
+    case 0x10:
+        if (Function == 0x0E)
+            ConsoleWrite(Emulator, (char)RegRead(Emulator, RegisterAX, 1));
+        else if (Function == 0x0F)
+        {
+            RegWrite(Emulator, RegisterAX, 0x5003, 2);
+            RegWrite(Emulator, 7, 0, 1);
+        }
+        else if (Function == 0x13)
+        {
+            uint32_t String = SegmentLinear(Emulator, SegmentES, RegRead(Emulator, RegisterBP, 2));
+
+            for (uint32_t i = 0; i < RegRead(Emulator, RegisterCX, 2); i++)
+                ConsoleWrite(Emulator, (char)MemRead(Emulator, String + i, 1));
+        }
+        return;
+
+    case 0x11:
+        RegWrite(Emulator, RegisterAX, 0x0027, 2);
+        return;
+
+    case 0x12:
+        RegWrite(Emulator, RegisterAX, 640, 2);
+        return;
+
+    case 0x13:
+        DiskService(Emulator);
+        return;
+
+    case 0x15:
+        if (Function == 0x24 || Function == 0x86)
+        {
+            RegWrite(Emulator, 4, 0, 1);
+            SetFlag(Emulator, EMULATOR_FLAG_CF, false);
+        }
+        else
+        {
+            RegWrite(Emulator, 4, 0x86, 1);
+            SetFlag(Emulator, EMULATOR_FLAG_CF, true);
+        }
+        return;
+
+    case 0x16:
+        /* No operator is in the loop, every prompt is answered with Enter */
+        if (Function == 0x00 || Function == 0x10)
+            RegWrite(Emulator, RegisterAX, 0x1C0D, 2);
+        else if (Function == 0x01 || Function == 0x11)
+            SetFlag(Emulator, EMULATOR_FLAG_ZF, true);
+        else
+            RegWrite(Emulator, RegisterAX, 0, 1);
+        return;
+
+    case 0x18:
+    case 0x19:
+        Stop(Emulator, STR_000027);
+        return;
+
+    case 0x1A:
+        if (Function == 0x00)
+        {
+            /* Ticks advance with the instruction count so that timeouts expire */
+            uint32_t Ticks = (uint32_t)(Emulator->Report->Instructions / 1000);
+
+            RegWrite(Emulator, RegisterCX, Ticks >> 16, 2);
+            RegWrite(Emulator, RegisterDX, Ticks, 2);
+            RegWrite(Emulator, RegisterAX, 0, 1);
+        }
+        SetFlag(Emulator, EMULATOR_FLAG_CF, false);
+        return;
+    }
+
+    uint32_t Entry = MemRead(Emulator, Vector * 4, 4);
+    if (!Entry)
+        return;
+
+    Push(Emulator, Emulator->Flags, 2);
+    Push(Emulator, Emulator->Segments[SegmentCS], 2);
+    Push(Emulator, Emulator->IP, 2);
+
+    SetFlag(Emulator, EMULATOR_FLAG_IF, false);
+    SetFlag(Emulator, EMULATOR_FLAG_TF, false);
+
+    Emulator->Segments[SegmentCS] = (uint16_t)(Entry >> 16);
+    Emulator->IP = (uint16_t)Entry;
+}
+
+/* Instructions */
+
+static void StringOperation(EMULATOR *Emulator, uint8_t Opcode)
+{
+    int Size = (Opcode & 1) ? OperandSize(Emulator) : 1;
+    int Source = Emulator->SegmentOverride != -1 ? Emulator->SegmentOverride : SegmentDS;
+    int Delta = GetFlag(Emulator, EMULATOR_FLAG_DF) ? -Size : Size;
+    bool Compare = (Opcode & 0xFE) == 0xA6 || (Opcode & 0xFE) == 0xAE;
+
+    for (;;)
+    {
+        if (Emulator->Repeat && !IndexRead(Emulator, RegisterCX))
+            break;
+
+        uint32_t SI = IndexRead(Emulator, RegisterSI), DI = IndexRead(Emulator, RegisterDI);
+
+        switch (Opcode & 0xFE)
+        {
+        case 0xA4:
+            MemWrite(Emulator, SegmentLinear(Emulator, SegmentES, DI),
+                     MemRead(Emulator, SegmentLinear(Emulator, Source, SI), Size), Size);
+            IndexWrite(Emulator, RegisterSI, SI + Delta);
+            IndexWrite(Emulator, RegisterDI, DI + Delta);
+            break;
+
+        case 0xA6:
+            Alu(Emulator, AluCmp, MemRead(Emulator, SegmentLinear(Emulator, Source, SI), Size),
+                MemRead(Emulator, SegmentLinear(Emulator, SegmentES, DI), Size), Size);
+            IndexWrite(Emulator, RegisterSI, SI + Delta);
+            IndexWrite(Emulator, RegisterDI, DI + Delta);
+            break;
+
+        case 0xAA:
+            MemWrite(Emulator, SegmentLinear(Emulator, SegmentES, DI), RegRead(Emulator, RegisterAX, Size), Size);
+            IndexWrite(Emulator, RegisterDI, DI + Delta);
+            break;
+
+        case 0xAC:
+            RegWrite(Emulator, RegisterAX, MemRead(Emulator, SegmentLinear(Emulator, Source, SI), Size), Size);
+            IndexWrite(Emulator, RegisterSI, SI + Delta);
+            break;
+
+        default:
+            Alu(Emulator, AluCmp, RegRead(Emulator, RegisterAX, Size),
+                MemRead(Emulator, SegmentLinear(Emulator, SegmentES, DI), Size), Size);
+            IndexWrite(Emulator, RegisterDI, DI + Delta);
+            break;
+        }
+
+        if (!Emulator->Repeat)
+            break;
+
+        IndexWrite(Emulator, RegisterCX, IndexRead(Emulator, RegisterCX) - 1);
+
+        if (Compare && Emulator->Repeat == 0xF3 && !GetFlag(Emulator, EMULATOR_FLAG_ZF))
+            break;
+
+        if (Compare && Emulator->Repeat == 0xF2 && GetFlag(Emulator, EMULATOR_FLAG_ZF))
+            break;
+    }
+}
+
+static void FarJump(EMULATOR *Emulator, uint16_t Segment, uint16_t Offset)
+{
+    Emulator->Segments[SegmentCS] = Segment;
+    Emulator->IP = Offset;
+}
+
+static void ExecuteExtended(EMULATOR *Emulator)
+{
+    uint8_t Opcode = (uint8_t)Fetch(Emulator, 1);
+    int Size = OperandSize(Emulator);
+    EMULATOR_OPERAND Operand;
+
+    if (Opcode >= 0x80 && Opcode <= 0x8F)
+    {
+        uint32_t Displacement = SignExtend(Fetch(Emulator, Size), Size);
+
+        if (Condition(Emulator, Opcode & 0x0F))
+            Emulator->IP += Displacement;
+        return;
+    }
+
+    if (Opcode >= 0x90 && Opcode <= 0x9F)
+    {
+        DecodeModRM(Emulator, &Operand);
+        OperandWrite(Emulator, &Operand, Condition(Emulator, Opcode & 0x0F), 1);
+        return;
+    }
+
+    switch (Opcode)
+    {
+    case 0x01:
+        DecodeModRM(Emulator, &Operand);
+
+        if (Operand.Reg == 4)
+            OperandWrite(Emulator, &Operand, Emulator->CR0, 2);
+        else if (Operand.Reg == 6)
+        {
+            Emulator->CR0 = (Emulator->CR0 & ~0xFu) | (OperandRead(Emulator, &Operand, 2) & 0xF);
+
+            if (Emulator->CR0 & 1)
+                Stop(Emulator, STR_000028);
+        }
+        return;
+
+    case 0x20:
+        DecodeModRM(Emulator, &Operand);
+        RegWrite(Emulator, Operand.Register, Operand.Reg == 0 ? Emulator->CR0 : 0, 4);
+        return;
+
+    case 0x22:
+        DecodeModRM(Emulator, &Operand);
+
+        if (Operand.Reg == 0)
+        {
+            Emulator->CR0 = RegRead(Emulator, Operand.Register, 4);
+
+            if (Emulator->CR0 & 1)
+                Stop(Emulator, STR_000028);
+        }
+        return;
+
+    case 0x31:
+        RegWrite(Emulator, RegisterAX, (uint32_t)Emulator->Report->Instructions, 4);
+        RegWrite(Emulator, RegisterDX, (uint32_t)(Emulator->Report->Instructions >> 32), 4);
+        return;
+
+    case 0xA2:
+        Emulator->Registers[RegisterAX] = Emulator->Registers[RegisterBX] = 0;
+        Emulator->Registers[RegisterCX] = Emulator->Registers[RegisterDX] = 0;
+        return;
+
+    case 0xA0:
+        Push(Emulator, Emulator->Segments[SegmentFS], Size);
+        return;
+
+    case 0xA1:
+        Emulator->Segments[SegmentFS] = (uint16_t)Pop(Emulator, Size);
+        return;
+
+    case 0xA8:
+        Push(Emulator, Emulator->Segments[SegmentGS], Size);
+        return;
+
+    case 0xA9:
+        Emulator->Segments[SegmentGS] = (uint16_t)Pop(Emulator, Size);
+        return;
+
+    case 0xA3:
+    case 0xAB:
+    case 0xB3:
+    case 0xBB:
+    case 0xBA:
+    {
+        DecodeModRM(Emulator, &Operand);
+
+        int Operation = Opcode == 0xBA ? Operand.Reg & 3 : (Opcode >> 3) & 3;
+        uint32_t Bit = Opcode == 0xBA ? Fetch(Emulator, 1) : RegRead(Emulator, Operand.Reg, Size);
+
+        if (!Operand.IsRegister && Opcode != 0xBA)
+            Operand.Linear += (uint32_t)(((int32_t)SignExtend(Bit, Size) >> (Size == 4 ? 5 : 4)) * Size);
+
+        Bit &= Size * 8 - 1;
+
+        uint32_t Value = OperandRead(Emulator, &Operand, Size);
+
+        SetFlag(Emulator, EMULATOR_FLAG_CF, (Value >> Bit) & 1);
+
+        if (Operation == 1)
+            OperandWrite(Emulator, &Operand, Value | (1u << Bit), Size);
+        else if (Operation == 2)
+            OperandWrite(Emulator, &Operand, Value & ~(1u << Bit), Size);
+        else if (Operation == 3)
+            OperandWrite(Emulator, &Operand, Value ^ (1u << Bit), Size);
+        return;
+    }
+
+    case 0xA4:
+    case 0xA5:
+    case 0xAC:
+    case 0xAD:
+    {
+        DecodeModRM(Emulator, &Operand);
+
+        uint8_t Count = (Opcode & 1) ? (uint8_t)RegRead(Emulator, RegisterCX, 1) : (uint8_t)Fetch(Emulator, 1);
+        uint32_t Result = DoubleShift(Emulator, Opcode < 0xA8, OperandRead(Emulator, &Operand, Size),
+                                      RegRead(Emulator, Operand.Reg, Size), Count, Size);
+
+        OperandWrite(Emulator, &Operand, Result, Size);
+        return;
+    }
+
+    case 0xAF:
+    {
+        DecodeModRM(Emulator, &Operand);
+
+        int64_t Product = (int64_t)(int32_t)SignExtend(RegRead(Emulator, Operand.Reg, Size), Size) *
+                          (int32_t)SignExtend(OperandRead(Emulator, &Operand, Size), Size);
+        bool Overflow = Product != (int64_t)(int32_t)SignExtend((uint32_t)Product & Mask(Size), Size);
+
+        RegWrite(Emulator, Operand.Reg, (uint32_t)Product, Size);
+        SetFlag(Emulator, EMULATOR_FLAG_CF, Overflow);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, Overflow);
+        return;
+    }
+
+    case 0xB2:
+    case 0xB4:
+    case 0xB5:
+    {
+        DecodeModRM(Emulator, &Operand);
+
+        int Segment = Opcode == 0xB2 ? SegmentSS : Opcode == 0xB4 ? SegmentFS : SegmentGS;
+
+        RegWrite(Emulator, Operand.Reg, MemRead(Emulator, Operand.Linear, Size), Size);
+        Emulator->Segments[Segment] = (uint16_t)MemRead(Emulator, Operand.Linear + Size, 2);
+        return;
+    }
+
+    case 0xB6:
+    case 0xB7:
+    case 0xBE:
+    case 0xBF:
+    {
+        DecodeModRM(Emulator, &Operand);
+
+        int SourceSize = (Opcode & 1) ? 2 : 1;
+        uint32_t Value = OperandRead(Emulator, &Operand, SourceSize);
+
+        if (Opcode >= 0xBE)
+            Value = SignExtend(Value, SourceSize);
+
+        RegWrite(Emulator, Operand.Reg, Value, Size);
+        return;
+    }
+
+    case 0xBC:
+    case 0xBD:
+    {
+        DecodeModRM(Emulator, &Operand);
+
+        uint32_t Value = OperandRead(Emulator, &Operand, Size);
+
+        SetFlag(Emulator, EMULATOR_FLAG_ZF, Value == 0);
+
+        if (Value)
+            RegWrite(Emulator, Operand.Reg, Opcode == 0xBC ? __builtin_ctz(Value) : 31 - __builtin_clz(Value), Size);
+        return;
+    }
+    }
+
+    Stop(Emulator, STR_000029);
+}
+
+static void Execute(EMULATOR *Emulator)
+{
+    EMULATOR_OPERAND Operand;
+    uint8_t Opcode;
+
+    Emulator->SegmentOverride = -1;
+    Emulator->OperandSize32 = false;
+    Emulator->AddressSize32 = false;
+    Emulator->Repeat = 0;
+    Emulator->InstructionIP = Emulator->IP;
+
+    for (;;)
+    {
+        Opcode = (uint8_t)Fetch(Emulator, 1);
+
+        if (Opcode == 0x26 || Opcode == 0x2E || Opcode == 0x36 || Opcode == 0x3E)
+            Emulator->SegmentOverride = (Opcode >> 3) & 3;
+        else if (Opcode == 0x64 || Opcode == 0x65)
+            Emulator->SegmentOverride = SegmentFS + (Opcode & 1);
+        else if (Opcode == 0x66)
+            Emulator->OperandSize32 = true;
+        else if (Opcode == 0x67)
+            Emulator->AddressSize32 = true;
+        else if (Opcode == 0xF2 || Opcode == 0xF3)
+            Emulator->Repeat = Opcode;
+        else if (Opcode != 0xF0)
+            break;
+    }
+
+    int Size = OperandSize(Emulator);
+
+    /* ADD, OR, ADC, SBB, AND, SUB, XOR and CMP share the same six encodings */
+    if (Opcode < 0x40 && (Opcode & 7) < 6)
+    {
+        int Operation = Opcode >> 3;
+        int OperationSize = (Opcode & 1) ? Size : 1;
+        uint32_t Result;
+
+        switch (Opcode & 7)
+        {
+        case 0:
+        case 1:
+            DecodeModRM(Emulator, &Operand);
+            Result = Alu(Emulator, Operation, OperandRead(Emulator, &Operand, OperationSize),
+                         RegRead(Emulator, Operand.Reg, OperationSize), OperationSize);
+
+            if (Operation != AluCmp)
+                OperandWrite(Emulator, &Operand, Result, OperationSize);
+            break;
+
+        case 2:
+        case 3:
+            DecodeModRM(Emulator, &Operand);
+            Result = Alu(Emulator, Operation, RegRead(Emulator, Operand.Reg, OperationSize),
+                         OperandRead(Emulator, &Operand, OperationSize), OperationSize);
+
+            if (Operation != AluCmp)
+                RegWrite(Emulator, Operand.Reg, Result, OperationSize);
+            break;
+
+        default:
+            Result = Alu(Emulator, Operation, RegRead(Emulator, RegisterAX, OperationSize),
+                         Fetch(Emulator, OperationSize), OperationSize);
+
+            if (Operation != AluCmp)
+                RegWrite(Emulator, RegisterAX, Result, OperationSize);
+            break;
+        }
+
+        return;
+    }
+
+    if (Opcode >= 0x40 && Opcode <= 0x4F)
+    {
+        int Register = Opcode & 7;
+
+        RegWrite(Emulator, Register, IncDec(Emulator, RegRead(Emulator, Register, Size), Opcode >= 0x48, Size), Size);
+        return;
+    }
+
+    if (Opcode >= 0x50 && Opcode <= 0x57)
+    {
+        Push(Emulator, RegRead(Emulator, Opcode & 7, Size), Size);
+        return;
+    }
+
+    if (Opcode >= 0x58 && Opcode <= 0x5F)
+    {
+        RegWrite(Emulator, Opcode & 7, Pop(Emulator, Size), Size);
+        return;
+    }
+
+    if (Opcode >= 0x70 && Opcode <= 0x7F)
+    {
+        uint32_t Displacement = SignExtend(Fetch(Emulator, 1), 1);
+
+        if (Condition(Emulator, Opcode & 0x0F))
+            Emulator->IP += Displacement;
+        return;
+    }
+
+    if (Opcode >= 0x91 && Opcode <= 0x97)
+    {
+        uint32_t Value = RegRead(Emulator, Opcode & 7, Size);
+
+        RegWrite(Emulator, Opcode & 7, RegRead(Emulator, RegisterAX, Size), Size);
+        RegWrite(Emulator, RegisterAX, Value, Size);
+        return;
+    }
+
+    if (Opcode >= 0xB0 && Opcode <= 0xB7)
+    {
+        RegWrite(Emulator, Opcode & 7, Fetch(Emulator, 1), 1);
+        return;
+    }
+
+    if (Opcode >= 0xB8 && Opcode <= 0xBF)
+    {
+        RegWrite(Emulator, Opcode & 7, Fetch(Emulator, Size), Size);
+        return;
+    }
+
+    if (Opcode >= 0xA4 && Opcode <= 0xAF && Opcode != 0xA8 && Opcode != 0xA9)
+    {
+        StringOperation(Emulator, Opcode);
+        return;
+    }
+
+    switch (Opcode)
+    {
+    case 0x06:
+    case 0x0E:
+    case 0x16:
+    case 0x1E:
+        Push(Emulator, Emulator->Segments[Opcode >> 3], Size);
+        return;
+
+    case 0x07:
+    case 0x17:
+    case 0x1F:
+        Emulator->Segments[Opcode >> 3] = (uint16_t)Pop(Emulator, Size);
+        return;
+
+    case 0x0F:
+        ExecuteExtended(Emulator);
+        return;
+
+    case 0x60:
+    {
+        uint32_t SP = RegRead(Emulator, RegisterSP, Size);
+
+        for (int i = 0; i < 8; i++)
+            Push(Emulator, i == RegisterSP ? SP : RegRead(Emulator, i, Size), Size);
+        return;
+    }
+
+    case 0x61:
+        for (int i = 7; i >= 0; i--)
+        {
+            uint32_t Value = Pop(Emulator, Size);
+
+            if (i != RegisterSP)
+                RegWrite(Emulator, i, Value, Size);
+        }
+        return;
+
+    case 0x68:
+        Push(Emulator, Fetch(Emulator, Size), Size);
+        return;
+
+    case 0x6A:
+        Push(Emulator, SignExtend(Fetch(Emulator, 1), 1), Size);
+        return;
+
+    case 0x69:
+    case 0x6B:
+    {
+        DecodeModRM(Emulator, &Operand);
+
+        uint32_t Immediate = Opcode == 0x6B ? SignExtend(Fetch(Emulator, 1), 1) : Fetch(Emulator, Size);
+        int64_t Product = (int64_t)(int32_t)SignExtend(OperandRead(Emulator, &Operand, Size), Size) *
+                          (int32_t)SignExtend(Immediate, Size);
+        bool Overflow = Product != (int64_t)(int32_t)SignExtend((uint32_t)Product & Mask(Size), Size);
+
+        RegWrite(Emulator, Operand.Reg, (uint32_t)Product, Size);
+        SetFlag(Emulator, EMULATOR_FLAG_CF, Overflow);
+        SetFlag(Emulator, EMULATOR_FLAG_OF, Overflow);
+        return;
+    }
+
+    case 0x80:
+    case 0x81:
+    case 0x83:
+    {
+        int OperationSize = Opcode == 0x80 ? 1 : Size;
+
+        DecodeModRM(Emulator, &Operand);
+
+        uint32_t Immediate = Opcode == 0x83 ? SignExtend(Fetch(Emulator, 1), 1) : Fetch(Emulator, OperationSize);
+        uint32_t Result = Alu(Emulator, Operand.Reg, OperandRead(Emulator, &Operand, OperationSize), Immediate, OperationSize);
+
+        if (Operand.Reg != AluCmp)
+            OperandWrite(Emulator, &Operand, Result, OperationSize);
+        return;
+    }
+
+    case 0x84:
+    case 0x85:
+    {
+        int OperationSize = (Opcode & 1) ? Size : 1;
+
+        DecodeModRM(Emulator, &Operand);
+        Alu(Emulator, AluAnd, OperandRead(Emulator, &Operand, OperationSize),
+            RegRead(Emulator, Operand.Reg, OperationSize), OperationSize);
+        return;
+    }
+
+    case 0x86:
+    case 0x87:
+    {
+        int OperationSize = (Opcode & 1) ? Size : 1;
+
+        DecodeModRM(Emulator, &Operand);
+
+        uint32_t Value = OperandRead(Emulator, &Operand, OperationSize);
+
+        OperandWrite(Emulator, &Operand, RegRead(Emulator, Operand.Reg, OperationSize), OperationSize);
+        RegWrite(Emulator, Operand.Reg, Value, OperationSize);
+        return;
+    }
+
+    case 0x88:
+    case 0x89:
+        DecodeModRM(Emulator, &Operand);
+        OperandWrite(Emulator, &Operand, RegRead(Emulator, Operand.Reg, (Opcode & 1) ? Size : 1), (Opcode & 1) ? Size : 1);
+        return;
+
+    case 0x8A:
+    case 0x8B:
+        DecodeModRM(Emulator, &Operand);
+        RegWrite(Emulator, Operand.Reg, OperandRead(Emulator, &Operand, (Opcode & 1) ? Size : 1), (Opcode & 1) ? Size : 1);
+        return;
+
+    case 0x8C:
+        DecodeModRM(Emulator, &Operand);
+        OperandWrite(Emulator, &Operand, Emulator->Segments[Operand.Reg % 6], Operand.IsRegister ? Size : 2);
+        return;
+
+    case 0x8D:
+        DecodeModRM(Emulator, &Operand);
+        RegWrite(Emulator, Operand.Reg, Operand.Offset, Size);
+        return;
+
+    case 0x8E:
+        DecodeModRM(Emulator, &Operand);
+        Emulator->Segments[Operand.Reg % 6] = (uint16_t)OperandRead(Emulator, &Operand, 2);
+        return;
+
+    case 0x8F:
+    {
+        uint32_t Value = Pop(Emulator, Size);
+
+        DecodeModRM(Emulator, &Operand);
+        OperandWrite(Emulator, &Operand, Value, Size);
+        return;
+    }
+
+    case 0x90:
+        return;
+
+    case 0x98:
+        if (Size == 4)
+            RegWrite(Emulator, RegisterAX, SignExtend(RegRead(Emulator, RegisterAX, 2), 2), 4);
+        else
+            RegWrite(Emulator, RegisterAX, SignExtend(RegRead(Emulator, RegisterAX, 1), 1), 2);
+        return;
+
+    case 0x99:
+        RegWrite(Emulator, RegisterDX, (RegRead(Emulator, RegisterAX, Size) & SignBit(Size)) ? 0xFFFFFFFF : 0, Size);
+        return;
+
+    case 0x9A:
+    {
+        uint16_t Offset = (uint16_t)Fetch(Emulator, 2), Segment = (uint16_t)Fetch(Emulator, 2);
+
+        Push(Emulator, Emulator->Segments[SegmentCS], 2);
+        Push(Emulator, Emulator->IP, 2);
+        FarJump(Emulator, Segment, Offset);
+        return;
+    }
+
+    case 0x9C:
+        Push(Emulator, Emulator->Flags, Size);
+        return;
+
+    case 0x9D:
+        Emulator->Flags = (Pop(Emulator, Size) & 0x0FD5) | EMULATOR_FLAG_RESERVED;
+        return;
+
+    case 0x9E:
+        Emulator->Flags = (Emulator->Flags & ~0xD5u) | (RegRead(Emulator, 4, 1) & 0xD5);
+        return;
+
+    case 0x9F:
+        RegWrite(Emulator, 4, Emulator->Flags & 0xFF, 1);
+        return;
+
+    case 0xA0:
+    case 0xA1:
+    case 0xA2:
+    case 0xA3:
+    {
+        int OperationSize = (Opcode & 1) ? Size : 1;
+        uint32_t Offset = Fetch(Emulator, Emulator->AddressSize32 ? 4 : 2);
+        uint32_t Linear = SegmentLinear(Emulator, Emulator->SegmentOverride != -1 ? Emulator->SegmentOverride : SegmentDS, Offset);
+
+        if (Opcode < 0xA2)
+            RegWrite(Emulator, RegisterAX, MemRead(Emulator, Linear, OperationSize), OperationSize);
+        else
+            MemWrite(Emulator, Linear, RegRead(Emulator, RegisterAX, OperationSize), OperationSize);
+        return;
+    }
+
+    case 0xA8:
+    case 0xA9:
+    {
+        int OperationSize = (Opcode & 1) ? Size : 1;
+
+        Alu(Emulator, AluAnd, RegRead(Emulator, RegisterAX, OperationSize), Fetch(Emulator, OperationSize), OperationSize);
+        return;
+    }
+
+    case 0xC0:
+    case 0xC1:
+    case 0xD0:
+    case 0xD1:
+    case 0xD2:
+    case 0xD3:
+    {
+        int OperationSize = (Opcode & 1) ? Size : 1;
+
+        DecodeModRM(Emulator, &Operand);
+
+        uint8_t Count = Opcode <= 0xC1 ? (uint8_t)Fetch(Emulator, 1)
+                        : Opcode <= 0xD1 ? 1
+                                         : (uint8_t)RegRead(Emulator, RegisterCX, 1);
+
+        OperandWrite(Emulator, &Operand,
+                     Shift(Emulator, Operand.Reg, OperandRead(Emulator, &Operand, OperationSize), Count, OperationSize),
+                     OperationSize);
+        return;
+    }
+
+    case 0xC2:
+    case 0xC3:
+    {
+        uint16_t Release = Opcode == 0xC2 ? (uint16_t)Fetch(Emulator, 2) : 0;
+
+        Emulator->IP = (uint16_t)Pop(Emulator, Size);
+        RegWrite(Emulator, RegisterSP, RegRead(Emulator, RegisterSP, 2) + Release, 2);
+        return;
+    }
+
+    case 0xC4:
+    case 0xC5:
+        DecodeModRM(Emulator, &Operand);
+        RegWrite(Emulator, Operand.Reg, MemRead(Emulator, Operand.Linear, Size), Size);
+        Emulator->Segments[Opcode == 0xC4 ? SegmentES : SegmentDS] = (uint16_t)MemRead(Emulator, Operand.Linear + Size, 2);
+        return;
+
+    case 0xC6:
+    case 0xC7:
+    {
+        int OperationSize = (Opcode & 1) ? Size : 1;
+
+        DecodeModRM(Emulator, &Operand);
+        OperandWrite(Emulator, &Operand, Fetch(Emulator, OperationSize), OperationSize);
+        return;
+    }
+
+    case 0xC8:
+    {
+        uint16_t Allocation = (uint16_t)Fetch(Emulator, 2);
+
+        Fetch(Emulator, 1);
+        Push(Emulator, RegRead(Emulator, RegisterBP, Size), Size);
+        RegWrite(Emulator, RegisterBP, RegRead(Emulator, RegisterSP, 2), 2);
+        RegWrite(Emulator, RegisterSP, RegRead(Emulator, RegisterSP, 2) - Allocation, 2);
+        return;
+    }
+
+    case 0xC9:
+        RegWrite(Emulator, RegisterSP, RegRead(Emulator, RegisterBP, 2), 2);
+        RegWrite(Emulator, RegisterBP, Pop(Emulator, Size), Size);
+        return;
+
+    case 0xCA:
+    case 0xCB:
+    {
+        uint16_t Release = Opcode == 0xCA ? (uint16_t)Fetch(Emulator, 2) : 0;
+        uint16_t Offset = (uint16_t)Pop(Emulator, Size), Segment = (uint16_t)Pop(Emulator, Size);
+
+        FarJump(Emulator, Segment, Offset);
+        RegWrite(Emulator, RegisterSP, RegRead(Emulator, RegisterSP, 2) + Release, 2);
+        return;
+    }
+
+    case 0xCC:
+        Interrupt(Emulator, 3);
+        return;
+
+    case 0xCD:
+        Interrupt(Emulator, (uint8_t)Fetch(Emulator, 1));
+        return;
+
+    case 0xCF:
+    {
+        uint16_t Offset = (uint16_t)Pop(Emulator, Size), Segment = (uint16_t)Pop(Emulator, Size);
+
+        FarJump(Emulator, Segment, Offset);
+        Emulator->Flags = (Pop(Emulator, Size) & 0x0FD5) | EMULATOR_FLAG_RESERVED;
+        return;
+    }
+
+    case 0xD7:
+    {
+        int Segment = Emulator->SegmentOverride != -1 ? Emulator->SegmentOverride : SegmentDS;
+        uint32_t Offset = (IndexRead(Emulator, RegisterBX) + RegRead(Emulator, RegisterAX, 1)) & (Emulator->AddressSize32 ? 0xFFFFFFFF : 0xFFFF);
+
+        RegWrite(Emulator, RegisterAX, MemRead(Emulator, SegmentLinear(Emulator, Segment, Offset), 1), 1);
+        return;
+    }
+
+    case 0xE0:
+    case 0xE1:
+    case 0xE2:
+    {
+        uint32_t Displacement = SignExtend(Fetch(Emulator, 1), 1);
+        uint32_t Count = IndexRead(Emulator, RegisterCX) - 1;
+        bool Taken = Count != 0;
+
+        IndexWrite(Emulator, RegisterCX, Count);
+
+        if (Opcode == 0xE0)
+            Taken = Taken && !GetFlag(Emulator, EMULATOR_FLAG_ZF);
+        else if (Opcode == 0xE1)
+            Taken = Taken && GetFlag(Emulator, EMULATOR_FLAG_ZF);
+
+        if (Taken)
+            Emulator->IP += Displacement;
+        return;
+    }
+
+    case 0xE3:
+    {
+        uint32_t Displacement = SignExtend(Fetch(Emulator, 1), 1);
+
+        if (!IndexRead(Emulator, RegisterCX))
+            Emulator->IP += Displacement;
+        return;
+    }
+
+    /* Ports are not emulated, keyboard controller polls see an idle controller */
+    case 0xE4:
+    case 0xE5:
+        Fetch(Emulator, 1);
+        /* fall through */
+    case 0xEC:
+    case 0xED:
+        RegWrite(Emulator, RegisterAX, 0, (Opcode & 1) ? Size : 1);
+        return;
+
+    case 0xE6:
+    case 0xE7:
+        Fetch(Emulator, 1);
+        return;
+
+    case 0xEE:
+    case 0xEF:
+        return;
+
+    case 0xE8:
+    {
+        uint32_t Displacement = Fetch(Emulator, Size);
+
+        Push(Emulator, Emulator->IP, Size);
+        Emulator->IP += Displacement;
+        return;
+    }
+
+    case 0xE9:
+        Emulator->IP += Fetch(Emulator, Size);
+        return;
+
+    case 0xEA:
+    {
+        uint16_t Offset = (uint16_t)Fetch(Emulator, Size), Segment = (uint16_t)Fetch(Emulator, 2);
+
+        FarJump(Emulator, Segment, Offset);
+        return;
+    }
+
+    case 0xEB:
+        Emulator->IP += SignExtend(Fetch(Emulator, 1), 1);
+        return;
+
+    case 0xF4:
+        Stop(Emulator, STR_000030);
+        return;
+
+    case 0xF5:
+        Emulator->Flags ^= EMULATOR_FLAG_CF;
+        return;
+
+    case 0xF6:
+    case 0xF7:
+    {
+        int OperationSize = (Opcode & 1) ? Size : 1;
+
+        DecodeModRM(Emulator, &Operand);
+
+        uint32_t Value = OperandRead(Emulator, &Operand, OperationSize);
+
+        switch (Operand.Reg)
+        {
+        case 0:
+        case 1:
+            Alu(Emulator, AluAnd, Value, Fetch(Emulator, OperationSize), OperationSize);
+            break;
+        case 2:
+            OperandWrite(Emulator, &Operand, ~Value, OperationSize);
+            break;
+        case 3:
+            OperandWrite(Emulator, &Operand, Alu(Emulator, AluSub, 0, Value, OperationSize), OperationSize);
+            break;
+        case 4:
+        case 5:
+            Multiply(Emulator, Value, Operand.Reg == 5, OperationSize);
+            break;
+        default:
+            if (!Divide(Emulator, Value, Operand.Reg == 7, OperationSize))
+                Stop(Emulator, STR_000031);
+            break;
+        }
+        return;
+    }
+
+    case 0xF8:
+    case 0xF9:
+        SetFlag(Emulator, EMULATOR_FLAG_CF, Opcode & 1);
+        return;
+
+    case 0xFA:
+    case 0xFB:
+        SetFlag(Emulator, EMULATOR_FLAG_IF, Opcode & 1);
+        return;
+
+    case 0xFC:
+    case 0xFD:
+        SetFlag(Emulator, EMULATOR_FLAG_DF, Opcode & 1);
+        return;
+
+    case 0xFE:
+    case 0xFF:
+    {
+        int OperationSize = (Opcode & 1) ? Size : 1;
+
+        DecodeModRM(Emulator, &Operand);
+
+        switch (Operand.Reg)
+        {
+        case 0:
+        case 1:
+            OperandWrite(Emulator, &Operand,
+                         IncDec(Emulator, OperandRead(Emulator, &Operand, OperationSize), Operand.Reg == 1, OperationSize),
+                         OperationSize);
+            return;
+
+        case 2:
+        {
+            uint32_t Target = OperandRead(Emulator, &Operand, Size);
+
+            Push(Emulator, Emulator->IP, Size);
+            Emulator->IP = (uint16_t)Target;
+            return;
+        }
+
+        case 3:
+            Push(Emulator, Emulator->Segments[SegmentCS], 2);
+            Push(Emulator, Emulator->IP, 2);
+            /* fall through */
+        case 5:
+            FarJump(Emulator, (uint16_t)MemRead(Emulator, Operand.Linear + Size, 2),
+                    (uint16_t)MemRead(Emulator, Operand.Linear, Size));
+            return;
+
+        case 4:
+            Emulator->IP = (uint16_t)OperandRead(Emulator, &Operand, Size);
+            return;
+
+        case 6:
+            Push(Emulator, OperandRead(Emulator, &Operand, Size), Size);
+            return;
+        }
+        break;
+    }
+    }
+
+    Stop(Emulator, STR_000029);
+}
+
+/* Boot stage tracking */
+
+static void TrackStage(EMULATOR *Emulator)
+{
+    uint16_t Segment = Emulator->Segments[SegmentCS];
+    uint32_t Linear = SegmentLinear(Emulator, SegmentCS, Emulator->IP) % EMULATOR_MEMORY_SIZE;
+    int64_t Origin = Emulator->Origin[Linear >> 4];
+
+    /* Code that was copied around keeps the stage it was copied from */
+    if (Origin < 0)
+        return;
+
+    if (Origin == 0)
+        Emulator->Stage = EmulatorStageMbr;
+    else if (IsVbrSector(Emulator, (uint64_t)Origin))
+        Emulator->Stage = EmulatorStageVbr;
+    else
+    {
+        EMULATOR_REPORT *Report = Emulator->Report;
+
+        Emulator->Stage = EmulatorStageLoader;
+        Report->Handoff = true;
+        Report->HandoffSegment = Segment;
+        Report->HandoffOffset = Emulator->IP;
+        Report->HandoffLBA = Origin;
+        Stop(Emulator, STR_000032);
+    }
+}
+
+static bool LoadPartitions(EMULATOR *Emulator, MBR *BootSector)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        MBR_PTE *PTE = &BootSector->PTE[i];
+        uint16_t VBRSize = SECTOR_SIZE;
+
+        if (!PTE->PartitionType || !PTE->LBAStartAddress)
+            continue;
+
+        VbrDetectFileSystem(Emulator->Disk, (uint64_t)PTE->LBAStartAddress * SECTOR_SIZE, &VBRSize);
+
+        EMULATOR_VBR_RANGE *Range = &Emulator->VbrRanges[Emulator->VbrRangeCount++];
+
+        Range->StartSector = PTE->LBAStartAddress;
+        Range->EndSector = Range->StartSector + VBRSize / SECTOR_SIZE;
+    }
+
+    return Emulator->VbrRangeCount != 0;
+}
+
+bool EmulatorRun(char *Image, EMULATOR_REPORT *Report)
+{
+    EMULATOR *Emulator = calloc(1, sizeof(EMULATOR));
+    bool Result = false;
+
+    memset(Report, 0, sizeof(EMULATOR_REPORT));
+    Report->HandoffLBA = -1;
+
+    if (!Emulator)
+    {
+        printf(DEBUG_STRING STR_000004);
+        return false;
+    }
+
+    Emulator->Report = Report;
+    Emulator->Memory = calloc(1, EMULATOR_MEMORY_SIZE);
+    Emulator->Origin = malloc(EMULATOR_PARAGRAPHS * sizeof(int64_t));
+
+    if (!Emulator->Memory || !Emulator->Origin)
+    {
+        printf(DEBUG_STRING STR_000004);
+        goto Exit;
+    }
+
+    memset(Emulator->Origin, 0xFF, EMULATOR_PARAGRAPHS * sizeof(int64_t));
+
+    Emulator->Disk = open(Image, O_RDONLY);
+    if (Emulator->Disk == -1)
+    {
+        printf(DEBUG_STRING STR_000002, Image);
+        goto Exit;
+    }
+
+    int64_t DiskSize = GetFileSize(Image);
+    if (DiskSize < (int64_t)MBR_SIZE)
+    {
+        printf(DEBUG_STRING STR_000007);
+        goto ExitDisk;
+    }
+
+    Emulator->DiskSectors = (uint64_t)DiskSize / SECTOR_SIZE;
+
+    /* The BIOS loads the first sector to 0000:7C00 and enters it with the drive number in DL */
+    if (DiskRead(Emulator, 0, 1, EMULATOR_BOOT_ADDRESS))
+    {
+        printf(DEBUG_STRING STR_000007);
+        goto ExitDisk;
+    }
+
+    Report->DiskReadCalls = Report->SectorsRead = 0;
+
+    MBR *BootSector = (MBR *)&Emulator->Memory[EMULATOR_BOOT_ADDRESS];
+
+    if (BootSector->MBRSignatureLow != MBR_SIGNATURE_LOW || BootSector->MBRSignatureHigh != MBR_SIGNATURE_HIGH)
+    {
+        printf(DEBUG_STRING STR_000008);
+        goto ExitDisk;
+    }
+
+    LoadPartitions(Emulator, BootSector);
+
+    /* Conventional memory size in KiB, read by some boot code from the BIOS data area */
+    MemWrite(Emulator, 0x413, 640, 2);
+
+    Emulator->Flags = EMULATOR_FLAG_RESERVED | EMULATOR_FLAG_IF;
+    Emulator->Registers[RegisterDX] = EMULATOR_BOOT_DRIVE;
+    Emulator->Registers[RegisterSP] = EMULATOR_BOOT_ADDRESS;
+    Emulator->IP = EMULATOR_BOOT_ADDRESS;
+    Emulator->Running = true;
+
+    while (Emulator->Running)
+    {
+        if (Report->Instructions >= EMULATOR_INSTRUCTION_LIMIT)
+        {
+            Stop(Emulator, STR_000033);
+            break;
+        }
+
+        TrackStage(Emulator);
+        if (!Emulator->Running)
+            break;
+
+        Report->Instructions++;
+        Report->StageInstructions[Emulator->Stage]++;
+
+        Execute(Emulator);
+    }
+
+    if (!Report->Handoff)
+    {
+        Report->HandoffSegment = Emulator->Segments[SegmentCS];
+        Report->HandoffOffset = Emulator->InstructionIP;
+    }
+
+    Emulator->Console[Emulator->ConsoleLength] = '\0';
+    if (Emulator->ConsoleLength)
+        printf(STR_000034, Emulator->Console);
+
+    Result = true;
+
+ExitDisk:
+    close(Emulator->Disk);
+
+Exit:
+    free(Emulator->Memory);
+    free(Emulator->Origin);
+    free(Emulator);
+    return Result;
+}
+
+bool EmulatorBoot(char *Image)
+{
+    EMULATOR_REPORT Report;
+
+    if (!EmulatorRun(Image, &Report))
+        return false;
+
+    printf(STR_000035,
+           (unsigned long long)Report.Instructions,
+           (unsigned long long)Report.StageInstructions[EmulatorStageMbr],
+           (unsigned long long)Report.StageInstructions[EmulatorStageVbr],
+           (unsigned long long)Report.DiskReadCalls,
+           (unsigned long long)Report.SectorsRead,
+           (unsigned long long)Report.DiskWriteCalls,
+           Report.StopReason,
+           Report.HandoffSegment, Report.HandoffOffset,
+           (long long)Report.HandoffLBA);
+
+    return Report.Handoff;
+}
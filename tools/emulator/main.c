@@ -0,0 +1,22 @@
+/*
+ * PROJECT:     BootSectorInstaller
+ * LICENSE:     MIT (https://spdx.org/licenses/MIT)
+ * PURPOSE:     The real mode boot emulator entry point, kept out of the installer
+ * COPYRIGHT:   Copyright 2024 Daniel Victor <ilauncherdeveloper@gmail.com>
+ */
+
+#include <lib/default.h>
+#include <emulator.h>
+
+bool InvertedFlashDirection = false;
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        printf(STR_000026, *argv);
+        return 1;
+    }
+
+    return EmulatorBoot(argv[1]) ? 0 : 1;
+}